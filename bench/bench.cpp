@@ -0,0 +1,193 @@
+#include <benchmark/benchmark.h>
+#include "BitonicSorter.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+/* Sorts every combination of key type, size, direction and input distribution.
+   Besides the wall time every run reports the device time of the upload, the kernels and the download, and elements/sec.
+   Uploads and downloads are the device copies between the pinned staging buffer and the sort buffer, the host copies
+   into and out of the mapped staging buffer only show in the wall time.
+   Results are written to bsortBench.json unless --benchmark_out is given.
+   BSORT_PLATFORM selects the platform (the first one by default), BSORT_BENCH_MAX_LOG2 caps the sizes. */
+
+enum Distribution {
+    UNIFORM,
+    SORTED,
+    REVERSED,
+    FEW_UNIQUE,
+    ZIPF,
+    NEARLY_SORTED
+};
+
+const char* DISTRIBUTION_NAMES[] = {"uniform", "sorted", "reversed", "few_unique", "zipf", "nearly_sorted"};
+
+const int MIN_LOG2 = 10;
+const int MAX_LOG2 = 28;
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+std::string Platform() {
+    auto platform = std::getenv("BSORT_PLATFORM");
+    return platform ? platform : "";
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+int MaxLog2() {
+    auto limit = std::getenv("BSORT_BENCH_MAX_LOG2");
+    return limit ? std::clamp(std::atoi(limit), MIN_LOG2, MAX_LOG2) : MAX_LOG2;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+template <typename T>
+OpenCLApp::BitonicSorter<T>& Sorter() {
+    /* One sorter per type, built and tuned before the first measurement */
+    static auto sort = [] {
+        auto sort = std::make_unique<OpenCLApp::BitonicSorter<T>>(Platform());
+        sort->setHostThreshold(0);
+        /* The profile keeps the events of every command until it is cleared, which each iteration does */
+        sort->setProfiling(true);
+        return sort;
+    }();
+    return *sort;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+template <typename T>
+std::vector<T> MakeInput(size_t size, Distribution distribution) {
+    std::mt19937_64 gen(42);
+    std::uniform_real_distribution<double> real(-1e6, 1e6);
+    auto random = [&] {
+        if constexpr (std::is_floating_point_v<T>) return static_cast<T>(real(gen));
+        else return static_cast<T>(gen());
+    };
+
+    std::vector<T> data(size);
+    switch (distribution) {
+        case UNIFORM:
+        case SORTED:
+        case REVERSED:
+        case NEARLY_SORTED:
+            for (auto& x: data) x = random();
+            break;
+
+        case FEW_UNIQUE:
+            for (auto& x: data) x = static_cast<T>(gen() % 16);
+            break;
+
+        case ZIPF: {
+            /* Inverse of the continuous Zipf CDF with exponent 1.1 over ranks 1..size */
+            const double s = 1.1;
+            std::uniform_real_distribution<double> unit(0.0, 1.0);
+            double top = std::pow(static_cast<double>(size), 1.0 - s) - 1.0;
+            for (auto& x: data) x = static_cast<T>(std::floor(std::pow(unit(gen) * top + 1.0, 1.0 / (1.0 - s))));
+            break;
+        }
+    }
+
+    if (distribution == SORTED || distribution == NEARLY_SORTED) std::sort(data.begin(), data.end());
+    if (distribution == REVERSED) std::sort(data.begin(), data.end(), std::greater<T> {});
+
+    /* One percent of the elements trade places */
+    if (distribution == NEARLY_SORTED) {
+        std::uniform_int_distribution<size_t> position(0, size - 1);
+        for (size_t i = 0; i < size / 100; ++i) std::swap(data[position(gen)], data[position(gen)]);
+    }
+    return data;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+template <typename T>
+void BM_Sort(benchmark::State& state) {
+    size_t size = size_t(1) << state.range(0);
+    auto direction = state.range(1) ? OpenCLApp::DECREASING : OpenCLApp::INCREASING;
+    auto distribution = static_cast<Distribution>(state.range(2));
+    auto algorithm = state.range(3) ? OpenCLApp::RADIX : OpenCLApp::BITONIC;
+
+    auto& sort = Sorter<T>();
+    sort.setAlgorithm(algorithm);
+    if (size > sort.maxSortSize()) {
+        state.SkipWithError("The array exceeds the device allocation limit");
+        return;
+    }
+
+    auto input = MakeInput<T>(size, distribution);
+    std::vector<T> data(size);
+    std::chrono::nanoseconds upload {0}, kernels {0}, download {0};
+
+    for (auto _: state) {
+        state.PauseTiming();
+        std::copy(input.begin(), input.end(), data.begin());
+        sort.clearProfile();
+        state.ResumeTiming();
+
+        sort(data.begin(), data.end(), direction);
+
+        auto times = sort.lastSortTimes();
+        upload   += times.upload;
+        kernels  += times.kernels;
+        download += times.download;
+    }
+
+    auto average = [&](std::chrono::nanoseconds total) {
+        return std::chrono::duration<double, std::milli>(total).count() / state.iterations();
+    };
+    state.counters["staging_h2d_ms"] = average(upload);
+    state.counters["kernel_ms"]      = average(kernels);
+    state.counters["staging_d2h_ms"] = average(download);
+    state.counters["elements_per_second"] = benchmark::Counter(static_cast<double>(size), benchmark::Counter::kIsIterationInvariantRate);
+    state.SetLabel(DISTRIBUTION_NAMES[distribution]);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+template <typename T>
+void Register(const std::string& type) {
+    benchmark::RegisterBenchmark(("sort/" + type).c_str(), BM_Sort<T>)
+        ->ArgsProduct({benchmark::CreateDenseRange(MIN_LOG2, MaxLog2(), 2), {0, 1}, benchmark::CreateDenseRange(UNIFORM, NEARLY_SORTED, 1), {0, 1}})
+        ->ArgNames({"log2n", "decreasing", "distribution", "radix"})
+        ->UseRealTime()
+        ->Unit(benchmark::kMillisecond);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+    /* Keep a JSON copy of the results for regression tracking unless told where to put it */
+    std::vector<char*> args(argv, argv + argc);
+    std::string out = "--benchmark_out=bsortBench.json";
+    std::string format = "--benchmark_out_format=json";
+    bool hasOut = std::any_of(args.begin(), args.end(), [](const char* arg) {
+        return std::string_view {arg}.starts_with("--benchmark_out=");
+    });
+    if (!hasOut) {
+        args.push_back(out.data());
+        args.push_back(format.data());
+    }
+
+    int count = static_cast<int>(args.size());
+    benchmark::Initialize(&count, args.data());
+    if (benchmark::ReportUnrecognizedArguments(count, args.data())) return 1;
+
+    Register<int>("int");
+    Register<unsigned>("unsigned");
+    Register<int64_t>("int64_t");
+    Register<float>("float");
+    Register<double>("double");
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
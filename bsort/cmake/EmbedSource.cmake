@@ -0,0 +1,3 @@
+# Turns the kernel source into a C++ header: cmake -DINPUT=... -DTEMPLATE=... -DOUTPUT=... -P EmbedSource.cmake
+file(READ ${INPUT} KERNEL_SOURCE)
+configure_file(${TEMPLATE} ${OUTPUT} @ONLY)
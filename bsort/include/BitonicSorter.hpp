@@ -1,14 +1,37 @@
 #pragma once
 #include <cmath>
 #include <fstream>
+#include <future>
 #include <climits>
+#include <condition_variable>
+#include <cstdint>
 #include <iostream>
-#include "sourcePath.h"
+#include "SortEngine.hpp"
+#include "TuningCache.hpp"
+#include "BufferPool.hpp"
+#include "KernelTypeTraits.hpp"
+#include "SortTypes.hpp"
+#include "SortProfile.hpp"
+#include "RadixSort.hpp"
+#include <algorithm>
+#include <array>
 #include <bit>
 #include <cassert>
+#include <chrono>
 #include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
 #include <ostream>
+#include <random>
+#include <span>
 #include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+#include <vector>
 
 #define CL_HPP_TARGET_OPENCL_VERSION 220
 #define CL_HPP_ENABLE_EXCEPTIONS
@@ -27,38 +50,244 @@ namespace OpenCLApp {
         DECREASING = -1
     };
 
-    template <typename T>
+    /* Device algorithm of a sort. AUTOMATIC takes the radix sort for large arrays of the key types it supports */
+    enum SortAlgorithm {
+        AUTOMATIC,
+        BITONIC,
+        RADIX
+    };
+
+    /* Width is the number of elements in a kernel vector, 4, 8 or 16. The default suits the key size,
+       other widths let a device with wide native vectors, see preferredVectorWidth(), use them */
+    template <typename T, size_t Width>
     class BitonicSorter final
     {
+    public:
+        /* Largest number of merge strides one kernel launch performs, see bsort_merge2..4 */
+        static constexpr size_t MAX_FUSED_STEPS = 4;
+
+        /* The kernels index elements as a vector index times the width in uint, over arrays padded up to twice their size */
+        static constexpr size_t MAX_INDEXED_SIZE = std::bit_floor(size_t {std::numeric_limits<unsigned>::max()} / (2 * Width));
+
+        /* Output elements every work-item of bsort_merge_path merges, a work-group merges a tile of them in local memory */
+        static constexpr size_t MERGE_PATH_ITEMS = 8;
+
+        using Traits = KernelTypeTraits<T>;
+        using Key    = typename Traits::Key;
+        using Value  = typename Traits::Value;
+
+        /* 128-bit keys go through the key-value network, their high halves as keys and the low halves as values */
+        static constexpr bool IS_WIDE = std::is_same_v<T, UInt128>;
+
+        /* Size from which AUTOMATIC prefers the radix sort, its passes don't pay off on smaller arrays */
+        static constexpr size_t RADIX_THRESHOLD = 1 << 18;
+
+        static constexpr size_t VECTOR_WIDTH = Width;
+        static_assert(Width == 4 || Width == 8 || Width == 16, "The kernels take vectors of 4, 8 or 16 elements");
+
+        /* Device time of the stages of the last sort that went through a pooled buffer.
+           Transfers are the copies between the staging and the device buffer of the last buffer copied, i.e. the values
+           of a key-value sort, without the host copies into and out of the mapped staging buffer */
+        struct SortTimes {
+            std::chrono::nanoseconds upload   {0};
+            std::chrono::nanoseconds kernels  {0};
+            std::chrono::nanoseconds download {0};
+        };
+
     private:
+        /* Events bounding the stages of the last sort of one device */
+        struct SortEvents {
+            cl::Event upload, firstKernel, lastKernel, download;
+        };
+
         cl::vector<cl::Device> devices_;
         cl::Platform           platform_;
         cl::Context            context_;
+        std::string            comparator_;
         cl::Program            program_;
         cl::CommandQueue       queue_;
-
-        cl::KernelFunctor<cl::Buffer, cl::LocalSpaceArg>                     bsortlInit_;
-        cl::KernelFunctor<cl::Buffer, cl::LocalSpaceArg, unsigned, unsigned> bsortFirstStage_;
-        cl::KernelFunctor<cl::Buffer, cl::LocalSpaceArg, unsigned>           bsortSecondStage_;
-        cl::KernelFunctor<cl::Buffer, cl::LocalSpaceArg, unsigned, int>      bsortMerge_;
-        cl::KernelFunctor<cl::Buffer, cl::LocalSpaceArg, int>                bsortMergeLast_;
+        cl::CommandQueue       uploadQueue_;
+        cl::CommandQueue       downloadQueue_;
+        cl::vector<cl::CommandQueue> queues_;
+        BufferPool<Key>        pool_;
+        BufferPool<Value>      valuePool_;
+        size_t                 hostPtrAlignment_;
+        size_t                 hostThreshold_ = 0;
+        size_t                 fusedSteps_ = sizeof(T) <= 4 ? MAX_FUSED_STEPS : MAX_FUSED_STEPS - 1;
+        size_t                 maxLocalSize_ = 0;
+        bool                   profiling_ = false;
+        std::vector<SortEvents> events_;
+        SortProfile            profile_;
+        std::optional<RadixSort<Key>> radix_;
+        SortAlgorithm          algorithm_ = AUTOMATIC;
+        size_t                 radixThreshold_ = RADIX_THRESHOLD;
+
+        cl::KernelFunctor<cl::Buffer, cl::Buffer, cl::LocalSpaceArg, unsigned, int>  bsortlInit_;
+        cl::KernelFunctor<cl::Buffer, cl::Buffer, unsigned, unsigned, int>           bsortFlip_;
+        std::array<cl::KernelFunctor<cl::Buffer, cl::Buffer, unsigned, unsigned, int>, MAX_FUSED_STEPS> bsortMerge_;
+        cl::KernelFunctor<cl::Buffer, cl::Buffer, cl::LocalSpaceArg, unsigned, int>  bsortMergeLast_;
+        cl::KernelFunctor<cl::Buffer, cl::Buffer, unsigned, unsigned, int>           bsortTopK_;
+        cl::KernelFunctor<cl::Buffer, unsigned, cl::Buffer, unsigned, cl::Buffer, cl::LocalSpaceArg, unsigned, int> bsortMergePath_;
+
+        /* Key-value network of one build of bsort.cl */
+        struct KvKernels {
+            cl::KernelFunctor<cl::Buffer, cl::Buffer, cl::Buffer, cl::LocalSpaceArg, cl::LocalSpaceArg, unsigned, int> init;
+            cl::KernelFunctor<cl::Buffer, cl::Buffer, cl::Buffer, unsigned, unsigned, int>                             flip;
+            std::array<cl::KernelFunctor<cl::Buffer, cl::Buffer, cl::Buffer, unsigned, unsigned, int>, MAX_FUSED_STEPS> merge;
+            cl::KernelFunctor<cl::Buffer, cl::Buffer, cl::Buffer, cl::LocalSpaceArg, cl::LocalSpaceArg, unsigned, int> mergeLast;
+
+            KvKernels(const cl::Program& program);
+        };
+
+        /* The stable network breaks key ties by the values, which are then the original positions */
+        SortEngine*              engine_;
+        KvKernels                kv_;
+        std::optional<KvKernels> stableKv_;
+        bool                     stable_ = false;
+
+        std::mutex              asyncMutex_;
+        std::condition_variable asyncDone_;
+        size_t                  asyncInFlight_ = 0;
+
+        struct AsyncSort {
+            std::promise<void>               promise;
+            typename BufferPool<Key>::Lease  slot;
+            BitonicSorter*                   sorter;
+            std::span<T>                     data;
+            T*                               mapped = nullptr;
+        };
 
     public:
-        BitonicSorter(std::string requiredPlatform);
+        /* The comparator is OpenCL C spliced in ahead of bsort.cl, which defines LESS(a, b) or KEY(x) for scalars and vectors
+           of T, and ORDER_MAX and ORDER_MIN, the elements that go last and first, e.g. "#define KEY(x) fabs(x)" with
+           "#define ORDER_MAX NAN" and "#define ORDER_MIN 0.0f". Empty keeps the natural order, NaNs last.
+           A custom order always sorts on the first device with the bitonic network, std::sort and the radix sort don't know it */
+        BitonicSorter(std::string requiredPlatform, std::string comparator = {});
+        BitonicSorter(SortEngine& engine, std::string comparator = {});
+        ~BitonicSorter();
         
         template <typename Iterator>
         void operator() (Iterator begin, Iterator end, SortDirection direction = INCREASING); 
+        void operator() (std::span<T> data, SortDirection direction = INCREASING);
+
+        std::future<void> sortAsync(std::span<T> data, SortDirection direction = INCREASING);
+        void finish();
+
+        template <typename KeyIterator, typename ValueIterator>
+        void sortByKey(KeyIterator keysBegin, KeyIterator keysEnd, ValueIterator valuesBegin, SortDirection direction = INCREASING);
+        void sortSegments(std::span<T> data, std::span<const uint32_t> offsets, SortDirection direction = INCREASING);
+
+        template <typename Iterator>
+        std::vector<uint32_t> argsort(Iterator begin, Iterator end, SortDirection direction = INCREASING);
+
+        template <typename Iterator>
+        std::vector<T> topK(Iterator begin, Iterator end, size_t k, SortDirection direction = INCREASING);
+
+        /* Merges two arrays sorted in the direction into out, which holds both. Equal elements of a go first */
+        void merge(std::span<const T> a, std::span<const T> b, std::span<T> out, SortDirection direction = INCREASING);
+        /* Sorts only the batch and merges it into the sorted array, in linear time on the size of the array */
+        void insertSorted(std::vector<T>& sorted, std::span<const T> batch, SortDirection direction = INCREASING);
+
+        size_t maxSortSize() const;
+
+        /* Sorts shorter than the host threshold go to std::sort, the default 0 keeps every sort on the device.
+           calibrate() sets it to the measured host/device crossover, which is stored per device and type and reused
+           by later calibrations unless remeasure is set. It sorts up to 4M elements a few times, so it is opt-in */
+        size_t calibrate(bool remeasure = false);
+        size_t hostThreshold() const noexcept { return hostThreshold_; }
+        void setHostThreshold(size_t size) noexcept { hostThreshold_ = comparator_.empty() ? size : 0; }
+
+        size_t preferredVectorWidth() const;
+
+        size_t fusedSteps() const noexcept { return fusedSteps_; }
+        void setFusedSteps(size_t steps) noexcept { fusedSteps_ = std::clamp<size_t>(steps, 1, MAX_FUSED_STEPS); }
+
+        /* Upper bound on the work-group size, zero leaves it to the device and local memory limits */
+        size_t maxLocalSize() const noexcept { return maxLocalSize_; }
+        void setMaxLocalSize(size_t size) noexcept { maxLocalSize_ = size; }
+
+        /* Times every work-group size with every fusion depth on 2M elements, keeps the fastest and stores it
+           for the device, type and width, where later sorters load it at construction. It takes a while, so it is opt-in,
+           untuned sorters use the device limits and the deepest fusion that fits the key size */
+        void tune();
+
+        /* RADIX falls back to the bitonic network for key types the radix sort doesn't support */
+        SortAlgorithm algorithm() const noexcept { return algorithm_; }
+        void setAlgorithm(SortAlgorithm algorithm) noexcept { algorithm_ = algorithm; }
+        size_t radixThreshold() const noexcept { return radixThreshold_; }
+        void setRadixThreshold(size_t size) noexcept { radixThreshold_ = size; }
+
+        /* Keeps the values of equal keys of sortByKey() and argsort() in their original order, plain sorts are unaffected.
+           The first call with true builds the tie-breaking network */
+        bool stable() const noexcept { return stable_; }
+        void setStable(bool enabled);
+
+        const std::string& comparator() const noexcept { return comparator_; }
+
+        void setProfiling(bool enabled);
+        bool profiling() const noexcept { return profiling_; }
+        /* A sort split across devices has times on each of them, their clocks are unrelated */
+        SortTimes lastSortTimes(size_t device = 0) const;
+        size_t devices() const noexcept { return queues_.size(); }
+
+        /* Every launch and transfer since profiling was enabled or the profile cleared */
+        const SortProfile& profile() const noexcept { return profile_; }
+        void clearProfile() noexcept { profile_.clear(); }
+
+        void reserve(size_t size);
+        void setHighWaterMark(size_t bytes);
+        void releaseBuffers();
+
         std::string getOpenCLAppInfo(cl::Error& err) noexcept;
 
     private:
-        cl::Platform initPlatform(std::string requiredPlatform);
-        cl::Program initProgram();
+        cl::Program initProgram(SortEngine& engine);
+        size_t initHostPtrAlignment();
+        void initProfile();
+        bool useRadix(size_t size, size_t segments, size_t device) const noexcept;
+        static void checkSize(size_t size);
+        void record(const char* stage, size_t stride, size_t size, size_t device, const cl::Event& event);
+        std::string profileKey(const std::string& name) const;
+
+        static std::vector<T> tuningData(size_t size);
+        template <typename SortData>
+        static std::chrono::steady_clock::duration bestTime(const std::vector<T>& source, std::vector<T>& data, size_t size,
+                                                            SortData&& sortData);
 
-        template <typename KernelFunctor> 
-        cl::size_type localSize(KernelFunctor&& functor, size_t global_ize);
+        template <typename Iterator>
+        void sortOnHost(Iterator begin, Iterator end, SortDirection direction);
+        void mergeOnHost(std::span<const T> a, std::span<const T> b, std::span<T> out, SortDirection direction);
 
-        cl::Platform FindPlatform(const cl::vector<cl::Platform>& platforms, std::string platform_name);
-        void InitDevices(const cl::Platform& platform, cl::vector<cl::Device>& devices);
+        void sortBuffer(cl::Buffer& buffer, size_t size, SortDirection direction,
+                        const cl::Buffer& offsets = {}, size_t segments = 1, size_t device = 0);
+        void sortBuffer(cl::Buffer& keys, cl::Buffer& values, size_t size, SortDirection direction,
+                        const cl::Buffer& offsets = {}, size_t segments = 1);
+
+        cl::Event mergeBuffers(const cl::Buffer& a, size_t aSize, const cl::Buffer& b, size_t bSize, cl::Buffer& out,
+                               SortDirection direction);
+
+        template <typename Init, typename Flip, typename Merge, typename MergeLast>
+        void enqueueNetwork(size_t size, size_t segments, size_t local_size,
+                            Init&& init, Flip&& flip, Merge&& merge, MergeLast&& mergeLast, size_t device = 0);
+        template <typename Merge, typename MergeLast>
+        void enqueueMerge(size_t size, size_t segments, size_t local_size, size_t half,
+                          Merge&& merge, MergeLast&& mergeLast, size_t device = 0);
+
+        template <typename Iterator>
+        void sortAcrossDevices(Iterator begin, Iterator end, SortDirection direction);
+        template <typename Iterator>
+        void sortWide(Iterator begin, Iterator end, SortDirection direction);
+
+        template <typename U, typename Fill>
+        void writeSlot(typename BufferPool<U>::Slot& slot, size_t size, Fill&& fill, size_t device = 0);
+        template <typename U, typename Drain>
+        void readSlot(typename BufferPool<U>::Slot& slot, size_t size, Drain&& drain, size_t device = 0);
+        bool isZeroCopyCompatible(std::span<T> data) const noexcept;
+        static void CL_CALLBACK onAsyncMapped(cl_event event, cl_int status, void* userData);
+        static void CL_CALLBACK onAsyncComplete(cl_event event, cl_int status, void* userData);
+
+        template <typename KernelFunctor> 
+        cl::size_type localSize(KernelFunctor&& functor, size_t global_size, size_t itemBytes, size_t device = 0);
     };
 };
 
@@ -68,206 +297,290 @@ namespace OpenCLApp {
 namespace OpenCLApp {
 
     namespace {
-        const char* SOURCE_FILE_NAME = CL_PROGRAM_PATH;
-
         std::string toString(cl_bool x) {
             if (x) return "true";
             return "false";
         }
 
-        template <typename Iterator>
-        size_t getBufferCapacity(Iterator begin, Iterator end) {
-            size_t numOfElem  = std::distance(begin, end) + 1;
-            size_t capacity = 1 << (CHAR_BIT * sizeof(numOfElem) - (std::countl_zero(numOfElem)));
-            if (capacity < 16) capacity = 16;
-            return capacity;
-        }
-
     };
 
     //------------------------------------------------------------------------------------------------------------------------------
 
-    template <typename T>
-    cl::Platform BitonicSorter<T>::FindPlatform(const cl::vector<cl::Platform>& platforms, std::string platform_name) {
-        
-        auto platform_it = std::find_if(platforms.begin(), platforms.end(), [&](cl::Platform platform) {
-            auto pl_name = platform.getInfo<CL_PLATFORM_NAME>();
-            return pl_name.find(platform_name) != pl_name.npos;
-        });
+    template <typename T, size_t Width>
+    cl::Program BitonicSorter<T, Width>::initProgram(SortEngine& engine) {
+        return engine.program(kernelOptions<T>(Width), BSORT_SOURCE, comparator_);
+    }
 
-        if (platform_it != platforms.end()) {
-            InitDevices(*platform_it, devices_);
-            return *platform_it;
-        }
-        else throw std::runtime_error("Can't find platform " + platform_name);
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    size_t BitonicSorter<T, Width>::initHostPtrAlignment() {
+        /* Zero-copy only pays off when the device works directly in host memory */
+        auto& device = devices_[0];
+        bool sharedMemory = device.getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_CPU;
+        sharedMemory = sharedMemory || device.getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>();
+        if (!sharedMemory) return 0;
+
+        /* CL_DEVICE_MEM_BASE_ADDR_ALIGN is given in bits */
+        return device.getInfo<CL_DEVICE_MEM_BASE_ADDR_ALIGN>() / CHAR_BIT;
     }
 
     //------------------------------------------------------------------------------------------------------------------------------
 
-    template <typename T>
-    void BitonicSorter<T>::InitDevices(const cl::Platform& platform, cl::vector<cl::Device>& devices) {
-        try {
-          platform.getDevices(CL_DEVICE_TYPE_GPU, &devices);
-        } 
-        catch (cl::Error& error) {
-            platform.getDevices(CL_DEVICE_TYPE_CPU, &devices);
+    template <typename T, size_t Width>
+    BitonicSorter<T, Width>::BitonicSorter(std::string requiredPlatform, std::string comparator) :
+        BitonicSorter {SortEngine::instance(requiredPlatform), std::move(comparator)}
+        {}
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    BitonicSorter<T, Width>::BitonicSorter(SortEngine& engine, std::string comparator) try :
+        devices_          {engine.devices()},
+        platform_         {engine.platform()},
+        context_          {engine.context()},
+        comparator_       {std::move(comparator)},
+        program_          {initProgram(engine)},
+        queue_            {context_, devices_[0]},
+        uploadQueue_      {context_, devices_[0]},
+        downloadQueue_    {context_, devices_[0]},
+        pool_             {context_},
+        valuePool_        {context_},
+        hostPtrAlignment_ {initHostPtrAlignment()},
+        bsortlInit_       {program_, "bsort_init"},
+        bsortFlip_        {program_, "bsort_flip"},
+        bsortMerge_       {{{program_, "bsort_merge"}, {program_, "bsort_merge2"}, {program_, "bsort_merge3"}, {program_, "bsort_merge4"}}},
+        bsortMergeLast_   {program_, "bsort_merge_last"},
+        bsortTopK_        {program_, "bsort_topk"},
+        bsortMergePath_   {program_, "bsort_merge_path"},
+        engine_           {&engine},
+        kv_               {program_}
+        {
+            if constexpr (IS_WIDE) {
+                if (!comparator_.empty()) throw std::runtime_error("Custom orders of 128-bit keys are not supported");
+            }
+
+            /* Every device of the engine gets a queue, the first one is shared with the single-device paths.
+               A custom order stays on the first device, the runs of the others would be merged on the host */
+            queues_.push_back(queue_);
+            if (comparator_.empty())
+                for (size_t i = 1; i < devices_.size(); ++i) queues_.emplace_back(context_, devices_[i]);
+            events_.resize(queues_.size());
+            if constexpr (RadixSort<Key>::SUPPORTED && !IS_WIDE)
+                if (comparator_.empty()) radix_.emplace(engine);
+
+            initProfile();
         }
+
+    catch (cl::Error& error) {
+        /* Build logs are reported by ProgramCache */
+        if (error.err() != CL_BUILD_PROGRAM_FAILURE)
+            throw std::runtime_error(getOpenCLAppInfo(error));
     }
+    
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    BitonicSorter<T, Width>::KvKernels::KvKernels(const cl::Program& program) :
+        init      {program, "bsort_kv_init"},
+        flip      {program, "bsort_kv_flip"},
+        merge     {{{program, "bsort_kv_merge"}, {program, "bsort_kv_merge2"}, {program, "bsort_kv_merge3"}, {program, "bsort_kv_merge4"}}},
+        mergeLast {program, "bsort_kv_merge_last"}
+        {}
 
     //------------------------------------------------------------------------------------------------------------------------------
 
-    template <typename T>
-    cl::Platform BitonicSorter<T>::initPlatform(std::string requiredPlatform) {
-        cl::vector<cl::Platform> platforms;
-        cl::Platform::get(&platforms);
-        return FindPlatform(platforms, requiredPlatform);
-        throw std::runtime_error("Can't find any platform");
+    template <typename T, size_t Width>
+    void BitonicSorter<T, Width>::setStable(bool enabled) {
+        /* 128-bit keys are whole in their pairs, their network is lexicographic already */
+        if constexpr (!IS_WIDE) {
+            if (enabled && !stableKv_)
+                stableKv_.emplace(engine_->program(kernelOptions<T>(Width) + " -DLEXICOGRAPHIC", BSORT_SOURCE, comparator_));
+        }
+        stable_ = enabled;
     }
 
     //------------------------------------------------------------------------------------------------------------------------------
 
-    template <>
-    cl::Program BitonicSorter<float>::initProgram() {
+    template <typename T, size_t Width>
+    size_t BitonicSorter<T, Width>::maxSortSize() const {
+        /* One buffer has to hold the whole array, and the kernels index it in uint */
+        size_t size = MAX_INDEXED_SIZE;
+        for (auto& device: devices_)
+            size = std::min<size_t>(size, device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>() / sizeof(Key));
+        return size;
+    }
 
-        std::ifstream programFile {SOURCE_FILE_NAME};
-        std::string programString(std::istreambuf_iterator<char>(programFile),
-                                 (std::istreambuf_iterator<char>()));
+    //------------------------------------------------------------------------------------------------------------------------------
 
-        cl::Program::Sources source {programString};
-        
-        cl::Program program {context_, source};
-        
-        const char type[] = "-DTYPE=float4 -DCOMPORATOR_TYPE=int4 -DMASK_TYPE=uint4 -DTYPE_CAST=as_uint4";
-        program.build(devices_, type);
+    template <typename T, size_t Width>
+    size_t BitonicSorter<T, Width>::preferredVectorWidth() const {
+        /* Zero means the device has no native vectors of the type, e.g. half without cl_khr_fp16 */
+        return devices_[0].getInfo<Traits::PREFERRED_WIDTH>();
+    }
 
-        return program;
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    std::string BitonicSorter<T, Width>::profileKey(const std::string& name) const {
+        return TuningCache::deviceKey(devices_[0]) + "|" + name + "|" + typeid(T).name() + "|" + std::to_string(Width);
     }
-    
+
     //------------------------------------------------------------------------------------------------------------------------------
 
-    template <>
-    cl::Program BitonicSorter<int>::initProgram() {
-        
-        std::ifstream programFile {SOURCE_FILE_NAME};
-        std::string programString(std::istreambuf_iterator<char>(programFile),
-                                 (std::istreambuf_iterator<char>()));
+    template <typename T, size_t Width>
+    size_t BitonicSorter<T, Width>::calibrate(bool remeasure) {
+        /* std::sort doesn't know a custom order */
+        if (!comparator_.empty()) return 0;
 
-        cl::Program::Sources source {programString};
-        
-        cl::Program program {context_, source};
-        
-        const char type[] = "-DTYPE=int4 -DCOMPORATOR_TYPE=int4 -DMASK_TYPE=uint4 -DTYPE_CAST=as_uint4";
-        program.build(devices_, type);
-        return program;
+        /* Calibration runs once per device and type, later sorters reuse the stored crossover */
+        if (auto stored = TuningCache::load(profileKey("crossover")); stored && !remeasure) return hostThreshold_ = *stored;
+
+        /* Double the size until the device beats std::sort, each side is timed by its best of a few runs */
+        constexpr size_t minSize = 1 << 10, maxSize = 1 << 22;
+
+        auto source = tuningData(maxSize);
+        std::vector<T> data(maxSize);
+
+        hostThreshold_ = 0;
+        size_t threshold = maxSize;
+        for (size_t size = minSize; size <= maxSize; size <<= 1) {
+            auto host   = bestTime(source, data, size, [&](auto begin, auto end) { sortOnHost(begin, end, INCREASING); });
+            auto device = bestTime(source, data, size, [&](auto begin, auto end) { (*this)(begin, end); });
+            if (device < host) {
+                threshold = size;
+                break;
+            }
+        }
+
+        pool_.releaseIdle();
+        hostThreshold_ = threshold;
+        TuningCache::store(profileKey("crossover"), threshold);
+        return threshold;
     }
 
     //------------------------------------------------------------------------------------------------------------------------------
 
-    template <>
-    cl::Program BitonicSorter<unsigned>::initProgram() {
-        
-        std::ifstream programFile {SOURCE_FILE_NAME};
-        std::string programString(std::istreambuf_iterator<char>(programFile),
-                                 (std::istreambuf_iterator<char>()));
-
-        cl::Program::Sources source {programString};
-        
-        cl::Program program {context_, source};
-        
-        const char type[] = "-DTYPE=uint4 -DCOMPORATOR_TYPE=int4 -DMASK_TYPE=uint4 -DTYPE_CAST=as_uint4";
-        program.build(devices_, type);
-        return program;
+    template <typename T, size_t Width>
+    void BitonicSorter<T, Width>::initProfile() {
+        /* A profile stored by tune() is loaded, without one the defaults stay */
+        auto local = TuningCache::load(profileKey("local"));
+        auto steps = TuningCache::load(profileKey("fused"));
+        if (local && steps) {
+            maxLocalSize_ = *local;
+            setFusedSteps(*steps);
+        }
     }
 
     //------------------------------------------------------------------------------------------------------------------------------
 
-    template <>
-    cl::Program BitonicSorter<double>::initProgram() {
-        
-        std::ifstream programFile {SOURCE_FILE_NAME};
-        std::string programString(std::istreambuf_iterator<char>(programFile),
-                                 (std::istreambuf_iterator<char>()));
+    template <typename T, size_t Width>
+    void BitonicSorter<T, Width>::tune() {
+        /* Time every power-of-two work-group size that fits the device together with every fusion depth,
+           the depth being the number of vectors a work-item of the merge kernels holds */
+        constexpr size_t size = 1 << 21;
+        auto source = tuningData(size);
+        std::vector<T> data(size);
+
+        /* Only the bitonic network depends on the profile */
+        size_t threshold = std::exchange(hostThreshold_, 0);
+        auto algorithm = std::exchange(algorithm_, BITONIC);
+        maxLocalSize_ = 0;
+        size_t largest = localSize(bsortlInit_, size, 2 * VECTOR_WIDTH * sizeof(Key));
+        size_t multiple = bsortlInit_.getKernel().template getWorkGroupInfo<CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(devices_[0]);
+        size_t smallest = std::min(std::bit_ceil(std::max<size_t>(multiple, 1)), largest);
+
+        auto best = std::chrono::steady_clock::duration::max();
+        size_t bestLocal = largest, bestSteps = fusedSteps_;
+        for (size_t local = smallest; local <= largest; local <<= 1) {
+            for (size_t steps = 1; steps <= MAX_FUSED_STEPS; ++steps) {
+                maxLocalSize_ = local;
+                fusedSteps_ = steps;
+                auto time = bestTime(source, data, size, [&](auto begin, auto end) { (*this)(begin, end); });
+                if (time < best) {
+                    best = time;
+                    bestLocal = local;
+                    bestSteps = steps;
+                }
+            }
+        }
 
-        cl::Program::Sources source {programString};
-        
-        cl::Program program {context_, source};
-        
-        const char type[] = "-DTYPE=double4 -DCOMPORATOR_TYPE=long4 -DMASK_TYPE=ulong4 -DTYPE_CAST=as_ulong4";
-        program.build(devices_, type);
-        return program;
+        pool_.releaseIdle();
+        hostThreshold_ = threshold;
+        algorithm_ = algorithm;
+        maxLocalSize_ = bestLocal;
+        fusedSteps_ = bestSteps;
+        TuningCache::store(profileKey("local"), bestLocal);
+        TuningCache::store(profileKey("fused"), bestSteps);
     }
 
     //------------------------------------------------------------------------------------------------------------------------------
 
-    template <>
-    cl::Program BitonicSorter<int64_t>::initProgram() {
-        
-        std::ifstream programFile {SOURCE_FILE_NAME};
-        std::string programString(std::istreambuf_iterator<char>(programFile),
-                                 (std::istreambuf_iterator<char>()));
+    template <typename T, size_t Width>
+    std::vector<T> BitonicSorter<T, Width>::tuningData(size_t size) {
+        /* Narrow types take the top bits, so half floats stay mostly finite */
+        constexpr int shift = 64 - CHAR_BIT * static_cast<int>(std::min(sizeof(T), sizeof(uint64_t)));
+        std::mt19937_64 gen(42);
+        std::vector<T> data(size);
+        for (auto& x: data) x = static_cast<T>(gen() >> shift);
+        return data;
+    }
 
-        cl::Program::Sources source {programString};
-        
-        cl::Program program {context_, source};
-        
-        const char type[] = "-DTYPE=long4 -DCOMPORATOR_TYPE=long4 -DMASK_TYPE=ulong4 -DTYPE_CAST=as_ulong4";
-        program.build(devices_, type);
-        return program;
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    template <typename SortData>
+    std::chrono::steady_clock::duration BitonicSorter<T, Width>::bestTime(const std::vector<T>& source, std::vector<T>& data, size_t size,
+                                                                          SortData&& sortData) {
+        /* Best of a few runs, the first run only warms up caches and pooled buffers */
+        constexpr size_t runs = 3;
+        using Clock = std::chrono::steady_clock;
+
+        auto best = Clock::duration::max();
+        for (size_t run = 0; run <= runs; ++run) {
+            std::copy(source.begin(), source.begin() + size, data.begin());
+            auto start = Clock::now();
+            sortData(data.begin(), data.begin() + size);
+            if (run) best = std::min(best, Clock::now() - start);
+        }
+        return best;
     }
 
     //------------------------------------------------------------------------------------------------------------------------------
 
-    template <>
-    cl::Program BitonicSorter<uint64_t>::initProgram() {
-        
-        std::ifstream programFile {SOURCE_FILE_NAME};
-        std::string programString(std::istreambuf_iterator<char>(programFile),
-                                 (std::istreambuf_iterator<char>()));
+    template <typename T, size_t Width>
+    template <typename Iterator>
+    void BitonicSorter<T, Width>::sortOnHost(Iterator begin, Iterator end, SortDirection direction) {
+        if (direction == INCREASING) std::sort(begin, end, SortLess<T> {});
+        else std::sort(begin, end, SortGreater<T> {});
+    }
 
-        cl::Program::Sources source {programString};
-        
-        cl::Program program {context_, source};
-        
-        const char type[] = "-DTYPE=ulong4 -DCOMPORATOR_TYPE=long4 -DMASK_TYPE=ulong4 -DTYPE_CAST=as_ulong4";
-        program.build(devices_, type);
-        return program;
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    void BitonicSorter<T, Width>::mergeOnHost(std::span<const T> a, std::span<const T> b, std::span<T> out, SortDirection direction) {
+        if (direction == INCREASING) std::merge(a.begin(), a.end(), b.begin(), b.end(), out.begin(), SortLess<T> {});
+        else std::merge(a.begin(), a.end(), b.begin(), b.end(), out.begin(), SortGreater<T> {});
     }
 
     //------------------------------------------------------------------------------------------------------------------------------
 
-    template <typename T>
-    BitonicSorter<T>::BitonicSorter(std::string requiredPlatform) try : 
-        platform_         {initPlatform(requiredPlatform)},
-        context_          {devices_},
-        program_          {initProgram()},
-        queue_            {context_, devices_[0]},
-        bsortlInit_       {program_, "bsort_init"},
-        bsortFirstStage_  {program_, "bsort_first_stage"},
-        bsortSecondStage_ {program_, "bsort_second_stage"},
-        bsortMerge_       {program_, "bsort_merge"},
-        bsortMergeLast_   {program_, "bsort_merge_last"}
-        {}
+    template <typename T, size_t Width>
+    BitonicSorter<T, Width> SortEngine::sorter() {
+        return BitonicSorter<T, Width> {*this};
+    }
 
-    catch (cl::Error& error) {
-        if (error.err() == CL_BUILD_PROGRAM_FAILURE) {
-            for (auto& dev: devices_) {
-                auto status = program_.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(dev);
-                if (status != CL_BUILD_ERROR)
-                    continue;
-
-                auto name = dev.getInfo<CL_DEVICE_NAME>();
-                auto buildlog = program_.getBuildInfo<CL_PROGRAM_BUILD_LOG>(dev);
-                std::cerr << "Build log for " << name << ":" << std::endl
-                          << buildlog << std::endl;
-            }
-        }
-        else throw std::runtime_error(getOpenCLAppInfo(error));
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    BitonicSorter<T, Width>::~BitonicSorter() {
+        finish();
     }
-    
+
     //------------------------------------------------------------------------------------------------------------------------------
 
-    template <typename T> 
-    std::string BitonicSorter<T>::getOpenCLAppInfo(cl::Error& err) noexcept {
+    template <typename T, size_t Width> 
+    std::string BitonicSorter<T, Width>::getOpenCLAppInfo(cl::Error& err) noexcept {
 
         std::string log;
         log += "current Error: ";
@@ -362,59 +675,728 @@ namespace OpenCLApp {
 
     //------------------------------------------------------------------------------------------------------------------------------
 
-    template <typename T>
+    template <typename T, size_t Width>
     template <typename KernelFunctor> 
-    cl::size_type BitonicSorter<T>::localSize(KernelFunctor&& functor, size_t global_size) {
-        auto local_size = functor.getKernel().template getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(devices_[0]);        
-        local_size = 1 << (CHAR_BIT * sizeof(local_size) - std::countl_zero(local_size) - 1); 
+    cl::size_type BitonicSorter<T, Width>::localSize(KernelFunctor&& functor, size_t global_size, size_t itemBytes, size_t device) {
+        auto local_size = functor.getKernel().template getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(devices_[device]);
+
+        /* The tile of a work-group has to fit into local memory, and the tuned limit applies on top */
+        local_size = std::min<size_t>(local_size, devices_[device].template getInfo<CL_DEVICE_LOCAL_MEM_SIZE>() / itemBytes);
+        if (maxLocalSize_) local_size = std::min(local_size, maxLocalSize_);
+        local_size = std::bit_floor(std::max<size_t>(local_size, 1));
         if(global_size < local_size) {
-            local_size = global_size;
+            local_size = std::bit_ceil(global_size);
         }
         return local_size;
     }
 
     //------------------------------------------------------------------------------------------------------------------------------
 
-    template <typename T>
+    template <typename T, size_t Width>
     template <typename Iterator> 
-    void BitonicSorter<T>::operator() (Iterator begin, Iterator end, SortDirection direction) {
-        std::cout << devices_.front().getInfo<CL_DEVICE_NAME>() << '\n';
-        /* Create buffer */
-        size_t capacity = getBufferCapacity(begin, end);
+    void BitonicSorter<T, Width>::operator() (Iterator begin, Iterator end, SortDirection direction) {
+        /* Take a device buffer from the pool and fill it through the pinned staging buffer */
+        size_t size = std::distance(begin, end);
+        if (size < 2) return;
+        if (size < hostThreshold_) {
+            sortOnHost(begin, end, direction);
+            return;
+        }
+        if constexpr (IS_WIDE) {
+            sortWide(begin, end, direction);
+        }
+        else if (queues_.size() > 1) {
+            sortAcrossDevices(begin, end, direction);
+        }
+        else {
+            auto slot = pool_.acquire(size);
+            writeSlot<T>(*slot, size, [&](T* mapped) { std::copy(begin, end, mapped); });
+            sortBuffer(slot->device, size, direction);
+            readSlot<T>(*slot, size, [&](const T* mapped) { std::copy(mapped, mapped + size, begin); });
+        }
+    }
 
-        T aggregate = std::numeric_limits<T>::max();
-        if (direction == DECREASING) aggregate = std::numeric_limits<T>::lowest();
+    //------------------------------------------------------------------------------------------------------------------------------
 
-        std::vector<T> data(capacity, aggregate);
-        std::copy(begin, end, data.begin());
-        
-        cl::Buffer buffer(context_, data.begin(), data.end(), false);
+    template <typename T, size_t Width>
+    template <typename Iterator>
+    void BitonicSorter<T, Width>::sortWide(Iterator begin, Iterator end, SortDirection direction) {
+        /* Split the keys into halves, the network orders the pairs lexicographically */
+        size_t size = std::distance(begin, end);
+        auto high = pool_.acquire(size);
+        auto low = valuePool_.acquire(size);
+
+        writeSlot<Key>(*high, size, [&](Key* mapped) { std::transform(begin, end, mapped, [](const T& x) { return x.hi; }); });
+        writeSlot<Value>(*low, size, [&](Value* mapped) { std::transform(begin, end, mapped, [](const T& x) { return x.lo; }); });
+        sortBuffer(high->device, low->device, size, direction);
+
+        readSlot<Key>(*high, size, [&](const Key* mapped) {
+            auto it = begin;
+            for (size_t i = 0; i < size; ++i, ++it) it->hi = mapped[i];
+        });
+        readSlot<Value>(*low, size, [&](const Value* mapped) {
+            auto it = begin;
+            for (size_t i = 0; i < size; ++i, ++it) it->lo = mapped[i];
+        });
+    }
 
-        /* Determine maximum work-group size */
-        size_t global_size = capacity / 8;
-        auto local_size = localSize(bsortlInit_, global_size);
-        std::cout << global_size << " " << local_size << std::endl;
-        /* Enqueue initial sorting kernel */
-        cl::EnqueueArgs args {queue_, cl::NullRange, global_size, local_size};
-        auto localBuffer = cl::Local(8 * local_size * sizeof(T));
-        bsortlInit_(args, buffer, localBuffer);
-
-        /* Execute further stages */
-        int num_stages = global_size/local_size;        
-        for(int high_stage = 2; high_stage < num_stages; high_stage <<= 1) {
-            for(int stage = high_stage; stage > 1; stage >>= 1) {
-                bsortFirstStage_(args, buffer, localBuffer, stage, high_stage);
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    template <typename Iterator>
+    void BitonicSorter<T, Width>::sortAcrossDevices(Iterator begin, Iterator end, SortDirection direction) {
+        /* Chunks are proportional to the compute units of each device */
+        size_t size = std::distance(begin, end);
+        size_t devices = queues_.size();
+
+        std::vector<size_t> bounds {0};
+        size_t units = 0;
+        for (auto& device: devices_) units += device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+        for (size_t i = 0, passed = 0; i < devices; ++i) {
+            passed += devices_[i].getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+            bounds.push_back(size * passed / units);
+        }
+
+        /* The staging buffers of all devices are mapped at once, so no device waits for the map of another */
+        std::vector<typename BufferPool<Key>::Lease> slots;
+        std::vector<T*> mapped(devices);
+        std::vector<cl::Event> mapEvents(devices), readEvents(devices), unmapEvents(devices);
+        for (size_t i = 0; i < devices; ++i) {
+            size_t chunk = bounds[i + 1] - bounds[i];
+            slots.push_back(pool_.acquire(std::max<size_t>(chunk, 1)));
+            if (chunk < 2) continue;
+            mapped[i] = static_cast<T*>(queues_[i].enqueueMapBuffer(slots[i]->staging, CL_FALSE, CL_MAP_WRITE_INVALIDATE_REGION, 0,
+                                                                    chunk * sizeof(T), nullptr, &mapEvents[i]));
+        }
+
+        /* Every device sorts its chunk, taken straight from the caller's range, on its own queue.
+           The queues run concurrently */
+        for (size_t i = 0; i < devices; ++i) {
+            size_t chunk = bounds[i + 1] - bounds[i];
+            if (chunk < 2) continue;
+            auto& queue = queues_[i];
+            auto& slot = *slots[i];
+
+            mapEvents[i].wait();
+            std::copy(std::next(begin, bounds[i]), std::next(begin, bounds[i + 1]), mapped[i]);
+            queue.enqueueUnmapMemObject(slot.staging, mapped[i]);
+            queue.enqueueCopyBuffer(slot.staging, slot.device, 0, 0, chunk * sizeof(T), nullptr, &events_[i].upload);
+            record("upload", 0, chunk, i, events_[i].upload);
+
+            sortBuffer(slot.device, chunk, direction, {}, 1, i);
+
+            queue.enqueueCopyBuffer(slot.device, slot.staging, 0, 0, chunk * sizeof(T), nullptr, &events_[i].download);
+            record("download", 0, chunk, i, events_[i].download);
+            mapped[i] = static_cast<T*>(queue.enqueueMapBuffer(slot.staging, CL_FALSE, CL_MAP_READ, 0, chunk * sizeof(T),
+                                                               nullptr, &readEvents[i]));
+            queue.flush();
+        }
+
+        /* The sorted chunks go back to where they came from, in the order the devices finish */
+        for (size_t i = 0; i < devices; ++i) {
+            if (bounds[i + 1] - bounds[i] < 2) continue;
+            readEvents[i].wait();
+            std::copy(mapped[i], mapped[i] + (bounds[i + 1] - bounds[i]), std::next(begin, bounds[i]));
+            queues_[i].enqueueUnmapMemObject(slots[i]->staging, mapped[i], nullptr, &unmapEvents[i]);
+            queues_[i].flush();
+        }
+
+        /* Merge neighbouring runs pairwise in place, doubling the run count each pass */
+        auto merge = [&](auto compare) {
+            for (size_t width = 1; width < devices; width *= 2) {
+                for (size_t i = 0; i + width < devices; i += 2 * width) {
+                    auto last = std::min(i + 2 * width, devices);
+                    std::inplace_merge(std::next(begin, bounds[i]), std::next(begin, bounds[i + width]), std::next(begin, bounds[last]),
+                                       compare);
+                }
+            }
+        };
+        if (direction == INCREASING) merge(SortLess<T> {});
+        else merge(SortGreater<T> {});
+
+        /* The slots go back to the pool once their staging buffers are unmapped */
+        for (auto& event: unmapEvents)
+            if (event()) event.wait();
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    template <typename KeyIterator, typename ValueIterator>
+    void BitonicSorter<T, Width>::sortByKey(KeyIterator keysBegin, KeyIterator keysEnd, ValueIterator valuesBegin, SortDirection direction) {
+        static_assert(!IS_WIDE, "128-bit keys already use the values for their low halves");
+        using Value = typename std::iterator_traits<ValueIterator>::value_type;
+
+        /* 32-bit values travel through the network themselves, anything else is gathered by the permutation.
+           A stable sort always carries the positions, the network orders equal keys by them */
+        constexpr bool isPayload = sizeof(Value) == sizeof(cl_uint) && std::is_trivially_copyable_v<Value>;
+        bool carryValues = isPayload && !stable_;
+
+        size_t size = std::distance(keysBegin, keysEnd);
+        if (size < 2) return;
+
+        /* Positions are complemented for the decreasing order, so that the earlier of equal keys still goes first */
+        cl_uint flip = direction == INCREASING ? 0u : ~0u;
+
+        auto keys = pool_.acquire(size);
+        auto values = valuePool_.acquire(size);
+
+        writeSlot<T>(*keys, size, [&](T* mapped) { std::copy(keysBegin, keysEnd, mapped); });
+        writeSlot<cl_uint>(*values, size, [&](cl_uint* mapped) {
+            if constexpr (isPayload) {
+                if (carryValues) {
+                    std::transform(valuesBegin, std::next(valuesBegin, size), mapped, [](const Value& x) { return std::bit_cast<cl_uint>(x); });
+                    return;
+                }
+            }
+            for (size_t i = 0; i < size; ++i) mapped[i] = static_cast<cl_uint>(i) ^ flip;
+        });
+
+        sortBuffer(keys->device, values->device, size, direction);
+
+        readSlot<T>(*keys, size, [&](const T* mapped) { std::copy(mapped, mapped + size, keysBegin); });
+        readSlot<cl_uint>(*values, size, [&](const cl_uint* mapped) {
+            if constexpr (isPayload) {
+                if (carryValues) {
+                    std::transform(mapped, mapped + size, valuesBegin, [](cl_uint x) { return std::bit_cast<Value>(x); });
+                    return;
+                }
             }
-            bsortSecondStage_(args, buffer, localBuffer, high_stage);
+            std::vector<Value> gathered;
+            gathered.reserve(size);
+            for (size_t i = 0; i < size; ++i) gathered.push_back(std::move(valuesBegin[mapped[i] ^ flip]));
+            std::move(gathered.begin(), gathered.end(), valuesBegin);
+        });
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    void BitonicSorter<T, Width>::sortSegments(std::span<T> data, std::span<const uint32_t> offsets, SortDirection direction) {
+        static_assert(!IS_WIDE, "Segmented sorting of 128-bit keys is not supported");
+        if (offsets.size() < 2) return;
+
+        /* Offsets hold the start of every segment followed by the end of the last one */
+        size_t longest = 0;
+        for (size_t i = 1; i < offsets.size(); ++i) {
+            if (offsets[i] < offsets[i - 1])
+                throw std::runtime_error("Segment offsets have to be non-decreasing");
+            longest = std::max<size_t>(longest, offsets[i] - offsets[i - 1]);
+        }
+        if (offsets.back() > data.size())
+            throw std::runtime_error("Segment offsets exceed the data size");
+        checkSize(data.size());
+        if (longest < 2) return;
+
+        /* One transfer and one network sized by the longest segment sort the whole batch */
+        auto slot = pool_.acquire(data.size());
+        auto bounds = valuePool_.acquire(offsets.size());
+
+        writeSlot<T>(*slot, data.size(), [&](T* mapped) { std::copy(data.begin(), data.end(), mapped); });
+        writeSlot<cl_uint>(*bounds, offsets.size(), [&](cl_uint* mapped) { std::copy(offsets.begin(), offsets.end(), mapped); });
+        sortBuffer(slot->device, longest, direction, bounds->device, offsets.size() - 1);
+        readSlot<T>(*slot, data.size(), [&](const T* mapped) { std::copy(mapped, mapped + data.size(), data.begin()); });
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    template <typename Iterator>
+    std::vector<uint32_t> BitonicSorter<T, Width>::argsort(Iterator begin, Iterator end, SortDirection direction) {
+        std::vector<T> keys(begin, end);
+        std::vector<uint32_t> permutation(keys.size());
+        std::iota(permutation.begin(), permutation.end(), 0u);
+
+        sortByKey(keys.begin(), keys.end(), permutation.begin(), direction);
+        return permutation;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    template <typename Iterator>
+    std::vector<T> BitonicSorter<T, Width>::topK(Iterator begin, Iterator end, size_t k, SortDirection direction) {
+        static_assert(!IS_WIDE, "Top-K selection of 128-bit keys is not supported");
+        size_t size = std::distance(begin, end);
+        k = std::min(k, size);
+        if (k == 0) return {};
+
+        /* The array is cut into sorted runs of `run` elements, the first k of a run are its candidates.
+           A run spans the tile of a full work-group at least, so a small k still keeps the device busy,
+           every work-group sorts as many k-runs at once as its tile holds */
+        size_t tileLocal = localSize(bsortlInit_, (size + 2 * VECTOR_WIDTH - 1) / (2 * VECTOR_WIDTH), 2 * VECTOR_WIDTH * sizeof(Key));
+        size_t run = std::max(std::bit_ceil(k), 2 * VECTOR_WIDTH * tileLocal);
+        size_t runs = (size + run - 1) / run;
+
+        /* A single run leaves nothing to discard, the array is simply sorted */
+        if (size < hostThreshold_ || runs < 2) {
+            std::vector<T> data(begin, end);
+            (*this)(data.begin(), data.end(), direction);
+            data.resize(k);
+            return data;
+        }
+
+        auto slot = pool_.acquire(size);
+        auto scratch = pool_.acquire((runs + 1) / 2 * run);
+        auto bounds = valuePool_.acquire(runs + 1);
+
+        writeSlot<T>(*slot, size, [&](T* mapped) { std::copy(begin, end, mapped); });
+        writeSlot<cl_uint>(*bounds, runs + 1, [&](cl_uint* mapped) {
+            for (size_t i = 0; i < runs; ++i) mapped[i] = static_cast<cl_uint>(i * run);
+            mapped[runs] = static_cast<cl_uint>(size);
+        });
+        sortBuffer(slot->device, run, direction, bounds->device, runs);
+
+        /* Every pass halves the number of runs, keeping the better half of each pair, until one run is left */
+        size_t vectors = run / VECTOR_WIDTH;
+        auto local_size = localSize(bsortlInit_, vectors / 2, 2 * VECTOR_WIDTH * sizeof(Key));
+        auto localBuffer = cl::Local(2 * VECTOR_WIDTH * local_size * sizeof(Key));
+
+        auto* input = &*slot;
+        auto* output = &*scratch;
+        for (size_t length = size; runs > 1; std::swap(input, output)) {
+            runs = (runs + 1) / 2;
+            record("topk", vectors, length, 0, bsortTopK_(cl::EnqueueArgs {queue_, runs * vectors}, input->device, output->device,
+                                                          length, vectors, direction));
+            length = runs * run;
+
+            auto& buffer = output->device;
+            enqueueMerge(length, 1, local_size, vectors,
+                [&](const cl::EnqueueArgs& args, size_t stride, size_t steps) {
+                    return bsortMerge_[steps - 1](args, buffer, cl::Buffer {}, length, stride, direction);
+                },
+                [&](const cl::EnqueueArgs& args) { return bsortMergeLast_(args, buffer, cl::Buffer {}, localBuffer, length, direction); });
+        }
+
+        /* Only the selected elements come back */
+        std::vector<T> result(k);
+        readSlot<T>(*input, k, [&](const T* mapped) { std::copy(mapped, mapped + k, result.begin()); });
+        return result;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    void BitonicSorter<T, Width>::merge(std::span<const T> a, std::span<const T> b, std::span<T> out, SortDirection direction) {
+        static_assert(!IS_WIDE, "Merging 128-bit keys is not supported");
+        if (out.size() != a.size() + b.size())
+            throw std::runtime_error("The output of a merge has to hold both inputs");
+        if (out.size() < hostThreshold_ || a.empty() || b.empty()) {
+            mergeOnHost(a, b, out, direction);
+            return;
+        }
+        checkSize(out.size());
+
+        auto first = pool_.acquire(a.size());
+        auto second = pool_.acquire(b.size());
+        auto merged = pool_.acquire(out.size());
+
+        writeSlot<T>(*first, a.size(), [&](T* mapped) { std::copy(a.begin(), a.end(), mapped); });
+        writeSlot<T>(*second, b.size(), [&](T* mapped) { std::copy(b.begin(), b.end(), mapped); });
+        events_[0].firstKernel = mergeBuffers(first->device, a.size(), second->device, b.size(), merged->device, direction);
+        readSlot<T>(*merged, out.size(), [&](const T* mapped) { std::copy(mapped, mapped + out.size(), out.begin()); });
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    void BitonicSorter<T, Width>::insertSorted(std::vector<T>& sorted, std::span<const T> batch, SortDirection direction) {
+        static_assert(!IS_WIDE, "Merging 128-bit keys is not supported");
+        if (batch.empty()) return;
+
+        size_t size = sorted.size() + batch.size();
+        if (size < hostThreshold_ || sorted.empty()) {
+            size_t middle = sorted.size();
+            sorted.insert(sorted.end(), batch.begin(), batch.end());
+            (*this)(sorted.begin() + middle, sorted.end(), direction);
+            if (direction == INCREASING) std::inplace_merge(sorted.begin(), sorted.begin() + middle, sorted.end(), SortLess<T> {});
+            else std::inplace_merge(sorted.begin(), sorted.begin() + middle, sorted.end(), SortGreater<T> {});
+            return;
+        }
+        checkSize(size);
+
+        auto first = pool_.acquire(sorted.size());
+        auto second = pool_.acquire(batch.size());
+        auto merged = pool_.acquire(size);
+
+        writeSlot<T>(*first, sorted.size(), [&](T* mapped) { std::copy(sorted.begin(), sorted.end(), mapped); });
+        writeSlot<T>(*second, batch.size(), [&](T* mapped) { std::copy(batch.begin(), batch.end(), mapped); });
+        events_[0].firstKernel = cl::Event {};
+        if (batch.size() > 1) sortBuffer(second->device, batch.size(), direction);
+        auto event = mergeBuffers(first->device, sorted.size(), second->device, batch.size(), merged->device, direction);
+        if (!events_[0].firstKernel()) events_[0].firstKernel = event;
+
+        sorted.resize(size);
+        readSlot<T>(*merged, size, [&](const T* mapped) { std::copy(mapped, mapped + size, sorted.begin()); });
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    void BitonicSorter<T, Width>::operator() (std::span<T> data, SortDirection direction) {
+        if (data.size() < 2) return;
+        if (IS_WIDE || data.size() < hostThreshold_ || !isZeroCopyCompatible(data)) {
+            (*this)(data.begin(), data.end(), direction);
+            return;
+        }
+
+        /* Let the device sort the caller's memory in place */
+        cl::Buffer buffer {context_, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, data.size_bytes(), data.data()};
+        sortBuffer(buffer, data.size(), direction);
+
+        /* Mapping makes the device results visible through the host pointer */
+        void* mapped = queue_.enqueueMapBuffer(buffer, CL_TRUE, CL_MAP_READ, 0, data.size_bytes());
+        queue_.enqueueUnmapMemObject(buffer, mapped);
+        queue_.finish();
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    std::future<void> BitonicSorter<T, Width>::sortAsync(std::span<T> data, SortDirection direction) {
+        static_assert(!IS_WIDE, "Asynchronous sorting of 128-bit keys is not supported");
+        /* The data has to stay alive until the returned future is ready */
+        std::promise<void> promise;
+        auto future = promise.get_future();
+        if (data.size() < 2) {
+            promise.set_value();
+            return future;
+        }
+
+        auto pending = std::make_unique<AsyncSort>(std::move(promise), pool_.acquire(data.size()), this, data);
+        auto& slot = *pending->slot;
+        size_t bytes = data.size_bytes();
+
+        /* The data goes through the pinned staging buffer, as in the synchronous sorts */
+        T* staged = static_cast<T*>(uploadQueue_.enqueueMapBuffer(slot.staging, CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION, 0, bytes));
+        std::copy(data.begin(), data.end(), staged);
+        uploadQueue_.enqueueUnmapMemObject(slot.staging, staged);
+
+        /* Upload, compute and download go to separate queues, so consecutive sorts overlap */
+        cl::vector<cl::Event> uploaded(1), sorted(1), downloaded(1);
+        cl::Event mapped;
+        try {
+            uploadQueue_.enqueueCopyBuffer(slot.staging, slot.device, 0, 0, bytes, nullptr, &uploaded[0]);
+            record("upload", 0, data.size(), 0, uploaded[0]);
+            queue_.enqueueBarrierWithWaitList(&uploaded);
+            sortBuffer(slot.device, data.size(), direction);
+            queue_.enqueueMarkerWithWaitList(nullptr, &sorted[0]);
+            downloadQueue_.enqueueCopyBuffer(slot.device, slot.staging, 0, 0, bytes, &sorted, &downloaded[0]);
+            record("download", 0, data.size(), 0, downloaded[0]);
+            pending->mapped = static_cast<T*>(downloadQueue_.enqueueMapBuffer(slot.staging, CL_FALSE, CL_MAP_READ, 0, bytes,
+                                                                              &downloaded, &mapped));
+
+            uploadQueue_.flush();
+            queue_.flush();
+            downloadQueue_.flush();
+        }
+        catch (...) {
+            /* Whatever was enqueued still uses the slot, it goes back to the pool only once the queues are idle */
+            uploadQueue_.finish();
+            queue_.finish();
+            downloadQueue_.finish();
+            throw;
+        }
+
+        {
+            std::lock_guard lock {asyncMutex_};
+            ++asyncInFlight_;
+        }
+        mapped.setCallback(CL_COMPLETE, onAsyncMapped, pending.release());
+        return future;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    void CL_CALLBACK BitonicSorter<T, Width>::onAsyncMapped(cl_event, cl_int status, void* userData) {
+        auto* pending = static_cast<AsyncSort*>(userData);
+        if (status < 0) {
+            onAsyncComplete(nullptr, status, userData);
+            return;
+        }
+
+        /* The staging buffer is unmapped before its slot may be leased again, so the slot goes back in onAsyncComplete */
+        std::copy(pending->mapped, pending->mapped + pending->data.size(), pending->data.begin());
+        try {
+            cl::Event unmapped;
+            auto& queue = pending->sorter->downloadQueue_;
+            queue.enqueueUnmapMemObject(pending->slot->staging, pending->mapped, nullptr, &unmapped);
+            queue.flush();
+            unmapped.setCallback(CL_COMPLETE, onAsyncComplete, userData);
+        }
+        catch (cl::Error& error) {
+            onAsyncComplete(nullptr, error.err(), userData);
+        }
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    void CL_CALLBACK BitonicSorter<T, Width>::onAsyncComplete(cl_event, cl_int status, void* userData) {
+        std::unique_ptr<AsyncSort> pending {static_cast<AsyncSort*>(userData)};
+        auto* sorter = pending->sorter;
+
+        if (status < 0) pending->promise.set_exception(std::make_exception_ptr(cl::Error {status, "sortAsync"}));
+        else pending->promise.set_value();
+
+        /* Return the buffers to the pool before the sorter may be destroyed */
+        pending.reset();
+
+        std::lock_guard lock {sorter->asyncMutex_};
+        --sorter->asyncInFlight_;
+        sorter->asyncDone_.notify_all();
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    void BitonicSorter<T, Width>::finish() {
+        std::unique_lock lock {asyncMutex_};
+        asyncDone_.wait(lock, [this] { return asyncInFlight_ == 0; });
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    bool BitonicSorter<T, Width>::isZeroCopyCompatible(std::span<T> data) const noexcept {
+        if (hostPtrAlignment_ == 0) return false;
+        return reinterpret_cast<std::uintptr_t>(data.data()) % hostPtrAlignment_ == 0;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    cl::Event BitonicSorter<T, Width>::mergeBuffers(const cl::Buffer& a, size_t aSize, const cl::Buffer& b, size_t bSize, cl::Buffer& out,
+                                                    SortDirection direction) {
+        /* One pass over the output, the work-groups find their parts of the inputs independently.
+           Every work-item needs local memory for MERGE_PATH_ITEMS inputs and as many merged outputs */
+        size_t size = aSize + bSize;
+        checkSize(size);
+        size_t items = (size + MERGE_PATH_ITEMS - 1) / MERGE_PATH_ITEMS;
+        auto local_size = localSize(bsortMergePath_, items, 2 * MERGE_PATH_ITEMS * sizeof(Key));
+        size_t tile = local_size * MERGE_PATH_ITEMS;
+        size_t groups = (size + tile - 1) / tile;
+
+        auto& events = events_[0];
+        events.lastKernel = bsortMergePath_(cl::EnqueueArgs {queue_, groups * local_size, local_size},
+                                            a, static_cast<unsigned>(aSize), b, static_cast<unsigned>(bSize), out,
+                                            cl::Local(2 * tile * sizeof(Key)), MERGE_PATH_ITEMS, direction);
+        record("merge_path", MERGE_PATH_ITEMS, size, 0, events.lastKernel);
+        return events.lastKernel;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    template <typename Init, typename Flip, typename Merge, typename MergeLast>
+    void BitonicSorter<T, Width>::enqueueNetwork(size_t size, size_t segments, size_t local_size,
+                                          Init&& init, Flip&& flip, Merge&& merge, MergeLast&& mergeLast, size_t device) {
+        /* Every work-item holds two vectors of VECTOR_WIDTH elements, a work-group sorts a tile of them.
+           Segments are laid out along the second dimension and sized by the longest one. */
+        size_t vectors = (size + VECTOR_WIDTH - 1) / VECTOR_WIDTH;
+        size_t tile = 2 * local_size;
+        size_t tiles = (vectors + tile - 1) / tile;
+
+        /* Enqueue initial sorting kernel */
+        auto& queue = queues_[device];
+        auto& events = events_[device];
+        events.firstKernel = events.lastKernel = init(cl::EnqueueArgs {queue, {tiles * local_size, segments}, {local_size, 1}});
+        record("init", 0, size, device, events.firstKernel);
+
+        /* Merge sorted runs until one run covers the whole array */
+        for(size_t half = tile; half < vectors; half <<= 1) {
+            cl::EnqueueArgs pairs {queue, {((vectors - 1) / (2 * half) + 1) * half, segments}, {local_size, 1}};
+            record("flip", half, size, device, flip(pairs, half));
+            enqueueMerge(size, segments, local_size, half, merge, mergeLast, device);
         }
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
 
-        /* Perform the bitonic merge */
-        for(int stage = num_stages; stage > 1; stage >>= 1) {
-            bsortMerge_(args, buffer, localBuffer, stage, direction); 
+    template <typename T, size_t Width>
+    template <typename Merge, typename MergeLast>
+    void BitonicSorter<T, Width>::enqueueMerge(size_t size, size_t segments, size_t local_size, size_t half,
+                                               Merge&& merge, MergeLast&& mergeLast, size_t device) {
+        /* Sort runs of `half` vectors that are bitonic, a run has to span one tile at least.
+           Strides down to the tile are fused, so each launch makes up to fusedSteps_ passes in one trip over the buffer */
+        size_t vectors = (size + VECTOR_WIDTH - 1) / VECTOR_WIDTH;
+        size_t tile = 2 * local_size;
+        size_t tiles = (vectors + tile - 1) / tile;
+        auto& queue = queues_[device];
+
+        /* Only groups of 2^steps vectors whose second vector lies inside the array have to be launched */
+        auto groups = [&](size_t distance, size_t steps) {
+            return cl::EnqueueArgs {queue, {((vectors - 1) / (distance << steps) + 1) * distance, segments}, {local_size, 1}};
+        };
+
+        for(size_t stride = half / 2; stride >= tile; ) {
+            size_t steps = std::min<size_t>(fusedSteps_, std::countr_zero(stride / tile) + 1);
+            record("merge", stride, size, device, merge(groups(stride >> (steps - 1), steps), stride, steps));
+            stride >>= steps;
         }
-        bsortMergeLast_(args, buffer, localBuffer, direction);
+        auto& events = events_[device];
+        events.lastKernel = mergeLast(cl::EnqueueArgs {queue, {tiles * local_size, segments}, {local_size, 1}});
+        record("merge_last", 0, size, device, events.lastKernel);
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    void BitonicSorter<T, Width>::checkSize(size_t size) {
+        /* Larger arrays would overflow the uint indices of the kernels */
+        if (size > MAX_INDEXED_SIZE)
+            throw std::runtime_error("Arrays of more than " + std::to_string(MAX_INDEXED_SIZE) + " elements can't be sorted at once");
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    bool BitonicSorter<T, Width>::useRadix(size_t size, size_t segments, size_t device) const noexcept {
+        /* The radix sort works on whole buffers of the first device, whose queue orders the use of its scratch buffer */
+        if (!radix_ || segments != 1 || device != 0) return false;
+        if (algorithm_ == RADIX) return true;
+        return algorithm_ == AUTOMATIC && size >= radixThreshold_;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    void BitonicSorter<T, Width>::sortBuffer(cl::Buffer& buffer, size_t size, SortDirection direction,
+                                      const cl::Buffer& offsets, size_t segments, size_t device) {
+        checkSize(size);
+        if (useRadix(size, segments, device)) {
+            auto& events = events_[device];
+            events.firstKernel = cl::Event {};
+            radix_->sortBuffer(queue_, buffer, size, direction, [&](const char* stage, size_t shift, const cl::Event& event) {
+                if (!events.firstKernel()) events.firstKernel = event;
+                events.lastKernel = event;
+                record(stage, shift, size, device, event);
+            });
+            return;
+        }
+
+        auto local_size = localSize(bsortlInit_, (size + 2 * VECTOR_WIDTH - 1) / (2 * VECTOR_WIDTH), 2 * VECTOR_WIDTH * sizeof(Key), device);
+        auto localBuffer = cl::Local(2 * VECTOR_WIDTH * local_size * sizeof(Key));
+
+        enqueueNetwork(size, segments, local_size,
+            [&](const cl::EnqueueArgs& args) { return bsortlInit_(args, buffer, offsets, localBuffer, size, direction); },
+            [&](const cl::EnqueueArgs& args, size_t half) { return bsortFlip_(args, buffer, offsets, size, half, direction); },
+            [&](const cl::EnqueueArgs& args, size_t stride, size_t steps) {
+                return bsortMerge_[steps - 1](args, buffer, offsets, size, stride, direction);
+            },
+            [&](const cl::EnqueueArgs& args) { return bsortMergeLast_(args, buffer, offsets, localBuffer, size, direction); },
+            device);
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    void BitonicSorter<T, Width>::sortBuffer(cl::Buffer& keys, cl::Buffer& values, size_t size, SortDirection direction,
+                                      const cl::Buffer& offsets, size_t segments) {
+        checkSize(size);
+        auto& kv = stable_ && stableKv_ ? *stableKv_ : kv_;
+        auto local_size = localSize(kv.init, (size + 2 * VECTOR_WIDTH - 1) / (2 * VECTOR_WIDTH),
+                                    2 * VECTOR_WIDTH * (sizeof(Key) + sizeof(Value)));
+        auto localKeys = cl::Local(2 * VECTOR_WIDTH * local_size * sizeof(Key));
+        auto localValues = cl::Local(2 * VECTOR_WIDTH * local_size * sizeof(Value));
+
+        enqueueNetwork(size, segments, local_size,
+            [&](const cl::EnqueueArgs& args) { return kv.init(args, keys, values, offsets, localKeys, localValues, size, direction); },
+            [&](const cl::EnqueueArgs& args, size_t half) { return kv.flip(args, keys, values, offsets, size, half, direction); },
+            [&](const cl::EnqueueArgs& args, size_t stride, size_t steps) {
+                return kv.merge[steps - 1](args, keys, values, offsets, size, stride, direction);
+            },
+            [&](const cl::EnqueueArgs& args) { return kv.mergeLast(args, keys, values, offsets, localKeys, localValues, size, direction); });
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    template <typename U, typename Fill>
+    void BitonicSorter<T, Width>::writeSlot(typename BufferPool<U>::Slot& slot, size_t size, Fill&& fill, size_t device) {
+        auto& queue = queues_[device];
+        U* mapped = static_cast<U*>(queue.enqueueMapBuffer(slot.staging, CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION, 0, size * sizeof(U)));
+        fill(mapped);
+        queue.enqueueUnmapMemObject(slot.staging, mapped);
+        queue.enqueueCopyBuffer(slot.staging, slot.device, 0, 0, size * sizeof(U), nullptr, &events_[device].upload);
+        record("upload", 0, size, device, events_[device].upload);
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    template <typename U, typename Drain>
+    void BitonicSorter<T, Width>::readSlot(typename BufferPool<U>::Slot& slot, size_t size, Drain&& drain, size_t device) {
+        auto& queue = queues_[device];
+        queue.enqueueCopyBuffer(slot.device, slot.staging, 0, 0, size * sizeof(U), nullptr, &events_[device].download);
+        record("download", 0, size, device, events_[device].download);
+        U* mapped = static_cast<U*>(queue.enqueueMapBuffer(slot.staging, CL_TRUE, CL_MAP_READ, 0, size * sizeof(U)));
+        drain(mapped);
+        queue.enqueueUnmapMemObject(slot.staging, mapped);
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    void BitonicSorter<T, Width>::setProfiling(bool enabled) {
+        /* Profiling is a property of a queue, so the queues are recreated once the pending work is done */
+        finish();
+        for (auto& queue: queues_) queue.finish();
+
+        cl_command_queue_properties properties = enabled ? CL_QUEUE_PROFILING_ENABLE : 0;
+        for (size_t i = 0; i < queues_.size(); ++i) queues_[i] = cl::CommandQueue {context_, devices_[i], properties};
+        queue_ = queues_[0];
+        uploadQueue_ = cl::CommandQueue {context_, devices_[0], properties};
+        downloadQueue_ = cl::CommandQueue {context_, devices_[0], properties};
+
+        events_.assign(queues_.size(), SortEvents {});
+        profile_.clear();
+        profiling_ = enabled;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    void BitonicSorter<T, Width>::record(const char* stage, size_t stride, size_t size, size_t device, const cl::Event& event) {
+        if (profiling_) profile_.record(stage, stride, size, device, event);
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    typename BitonicSorter<T, Width>::SortTimes BitonicSorter<T, Width>::lastSortTimes(size_t device) const {
+        if (!profiling_ || device >= events_.size() || !events_[device].download()) return {};
+
+        auto elapsed = [](const cl::Event& first, const cl::Event& last) {
+            return std::chrono::nanoseconds {last.getProfilingInfo<CL_PROFILING_COMMAND_END>() -
+                                             first.getProfilingInfo<CL_PROFILING_COMMAND_START>()};
+        };
+        auto& events = events_[device];
+        return {elapsed(events.upload, events.upload), elapsed(events.firstKernel, events.lastKernel),
+                elapsed(events.download, events.download)};
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    void BitonicSorter<T, Width>::reserve(size_t size) {
+        pool_.reserve(size);
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    void BitonicSorter<T, Width>::setHighWaterMark(size_t bytes) {
+        pool_.setHighWaterMark(bytes);
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
 
-        cl::copy(queue_, buffer, begin, end);
+    template <typename T, size_t Width>
+    void BitonicSorter<T, Width>::releaseBuffers() {
+        pool_.releaseIdle();
+        if (radix_) radix_->releaseScratch();
     }
 
     //------------------------------------------------------------------------------------------------------------------------------
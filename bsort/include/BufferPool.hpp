@@ -0,0 +1,195 @@
+#pragma once
+#include <cstddef>
+#include <limits>
+#include <list>
+#include <mutex>
+#include <utility>
+
+#define CL_HPP_TARGET_OPENCL_VERSION 220
+#define CL_HPP_ENABLE_EXCEPTIONS
+
+#ifdef MAC
+    #include <OpenCL/cl.hpp>
+#else
+    #include <CL/opencl.hpp>
+#endif
+
+
+namespace OpenCLApp {
+
+    /* Growable set of device buffers paired with page-locked staging buffers.
+       Slots are reused across sorts and are reallocated only when a bigger input arrives.
+       Leases may be returned from any thread, e.g. from an event callback. */
+    template <typename T>
+    class BufferPool final
+    {
+    public:
+        struct Slot {
+            cl::Buffer device;
+            cl::Buffer staging;
+            size_t     capacity = 0;
+            bool       busy     = false;
+        };
+
+        class Lease final
+        {
+        private:
+            BufferPool* pool_ = nullptr;
+            Slot*       slot_ = nullptr;
+
+        public:
+            Lease() = default;
+            Lease(BufferPool* pool, Slot* slot) : pool_ {pool}, slot_ {slot} {}
+            Lease(Lease&& other) noexcept : pool_ {std::exchange(other.pool_, nullptr)}, slot_ {std::exchange(other.slot_, nullptr)} {}
+            Lease& operator= (Lease&& other) noexcept;
+            Lease(const Lease&) = delete;
+            Lease& operator= (const Lease&) = delete;
+            ~Lease() { if (pool_) pool_->release(*slot_); }
+
+            Slot* operator-> () const { return slot_; }
+            Slot& operator*  () const { return *slot_; }
+        };
+
+    private:
+        cl::Context        context_;
+        std::list<Slot>    slots_;
+        size_t             highWaterMark_ = std::numeric_limits<size_t>::max();
+        mutable std::mutex mutex_;
+
+    public:
+        BufferPool(const cl::Context& context) : context_ {context} {}
+
+        Lease acquire(size_t capacity);
+        void reserve(size_t capacity);
+        void setHighWaterMark(size_t bytes);
+        size_t highWaterMark() const noexcept { return highWaterMark_; }
+        size_t allocatedBytes() const noexcept;
+        void releaseIdle();
+
+    private:
+        void release(Slot& slot);
+        void allocate(Slot& slot, size_t capacity);
+        size_t allocatedBytesLocked() const noexcept;
+        void trim();
+    };
+
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    typename BufferPool<T>::Lease& BufferPool<T>::Lease::operator= (Lease&& other) noexcept {
+        if (this != &other) {
+            if (pool_) pool_->release(*slot_);
+            pool_ = std::exchange(other.pool_, nullptr);
+            slot_ = std::exchange(other.slot_, nullptr);
+        }
+        return *this;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    void BufferPool<T>::allocate(Slot& slot, size_t capacity) {
+        slot.device   = cl::Buffer {};
+        slot.staging  = cl::Buffer {};
+        slot.capacity = 0;
+
+        slot.device   = cl::Buffer {context_, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, capacity * sizeof(T)};
+        slot.staging  = cl::Buffer {context_, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, capacity * sizeof(T)};
+        slot.capacity = capacity;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    typename BufferPool<T>::Lease BufferPool<T>::acquire(size_t capacity) {
+        std::lock_guard lock {mutex_};
+        Slot* best = nullptr;
+        Slot* idle = nullptr;
+
+        /* Prefer the smallest idle slot that already fits, otherwise grow the largest idle one */
+        for (auto& slot: slots_) {
+            if (slot.busy) continue;
+            if (slot.capacity >= capacity && (!best || slot.capacity < best->capacity)) best = &slot;
+            if (!idle || slot.capacity > idle->capacity) idle = &slot;
+        }
+
+        if (!best) {
+            if (!idle) idle = &slots_.emplace_back();
+            allocate(*idle, capacity);
+            best = idle;
+        }
+
+        best->busy = true;
+        return Lease {this, best};
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    void BufferPool<T>::release(Slot& slot) {
+        std::lock_guard lock {mutex_};
+        slot.busy = false;
+        trim();
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    void BufferPool<T>::reserve(size_t capacity) {
+        acquire(capacity);
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    void BufferPool<T>::setHighWaterMark(size_t bytes) {
+        std::lock_guard lock {mutex_};
+        highWaterMark_ = bytes;
+        trim();
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    size_t BufferPool<T>::allocatedBytes() const noexcept {
+        std::lock_guard lock {mutex_};
+        return allocatedBytesLocked();
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    size_t BufferPool<T>::allocatedBytesLocked() const noexcept {
+        size_t bytes = 0;
+        for (auto& slot: slots_) bytes += 2 * slot.capacity * sizeof(T);
+        return bytes;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    void BufferPool<T>::releaseIdle() {
+        std::lock_guard lock {mutex_};
+        slots_.remove_if([](const Slot& slot) { return !slot.busy; });
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    void BufferPool<T>::trim() {
+        /* Drop idle slots, largest first, until the pool fits under the high-water mark. The caller holds mutex_ */
+        while (allocatedBytesLocked() > highWaterMark_) {
+            auto victim = slots_.end();
+            for (auto it = slots_.begin(); it != slots_.end(); ++it) {
+                if (it->busy) continue;
+                if (victim == slots_.end() || it->capacity > victim->capacity) victim = it;
+            }
+            if (victim == slots_.end()) break;
+            slots_.erase(victim);
+        }
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+};
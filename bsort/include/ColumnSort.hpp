@@ -0,0 +1,195 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "BitonicSorter.hpp"
+
+
+namespace OpenCLApp {
+
+    /* Sorts the rows of a table given as one span per column (struct-of-arrays), lexicographically by the columns in order.
+       Every column may have its own arithmetic type and direction. Each value is mapped to unsigned bits that order
+       like the value in its direction, and consecutive columns are packed into one key as long as they fit 64 bits,
+       the first column in the highest bits. A table that fits one key is sorted by one stable pass through the network,
+       wider ones by one pass per key from the last to the first. Rows equal in every column keep their order. */
+    template <typename... Columns>
+    class ColumnSorter final
+    {
+    public:
+        static constexpr size_t COLUMNS = sizeof...(Columns);
+        static_assert(COLUMNS > 0, "A table needs at least one column");
+        static_assert(((std::is_arithmetic_v<Columns> && sizeof(Columns) <= 8) && ...), "Columns have to be numbers of up to 64 bits");
+
+        using Directions = std::array<SortDirection, COLUMNS>;
+
+        /* Bits of the key every column takes */
+        static constexpr std::array<size_t, COLUMNS> BITS {8 * sizeof(Columns)...};
+
+    private:
+        /* Columns [first, last) packed into one key of `bits` bits */
+        struct Group {
+            size_t first;
+            size_t last;
+            size_t bits;
+        };
+
+        BitonicSorter<uint32_t> narrow_;
+        BitonicSorter<uint64_t> wide_;
+
+    public:
+        ColumnSorter(SortEngine& engine);
+        ColumnSorter(std::string requiredPlatform) : ColumnSorter {SortEngine::instance(requiredPlatform)} {}
+
+        /* Directions default to INCREASING for every column */
+        std::vector<uint32_t> argsort(std::span<const Columns>... columns, const Directions& directions = {});
+        void operator() (std::span<Columns>... columns, const Directions& directions = {});
+
+        /* Passes through the network one sort takes, one per packed key */
+        static size_t passes() { return groups().size(); }
+
+    private:
+        static std::vector<Group> groups();
+
+        template <typename T>
+        static uint64_t code(T value, SortDirection direction);
+
+        template <typename Table>
+        static uint64_t pack(const Table& table, const Group& group, const Directions& directions, size_t row);
+
+        template <typename Key, typename Table>
+        void sortPass(BitonicSorter<Key>& sorter, const Table& table, const Group& group, const Directions& directions,
+                      std::vector<uint32_t>& permutation);
+    };
+
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename... Columns>
+    ColumnSorter<Columns...>::ColumnSorter(SortEngine& engine) :
+        narrow_ {engine},
+        wide_   {engine}
+        {
+            /* Rows with equal keys are ordered by their position, which makes the passes after the first one keep
+               the order of the previous ones and the rows equal in every column keep theirs */
+            narrow_.setStable(true);
+            wide_.setStable(true);
+        }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename... Columns>
+    std::vector<typename ColumnSorter<Columns...>::Group> ColumnSorter<Columns...>::groups() {
+        /* Greedy packing of consecutive columns gives the fewest keys */
+        std::vector<Group> groups;
+        for (size_t column = 0; column < COLUMNS; ++column) {
+            if (groups.empty() || groups.back().bits + BITS[column] > 64) groups.push_back({column, column, 0});
+            groups.back().last = column + 1;
+            groups.back().bits += BITS[column];
+        }
+        return groups;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename... Columns>
+    template <typename T>
+    uint64_t ColumnSorter<Columns...>::code(T value, SortDirection direction) {
+        using Bits = std::conditional_t<sizeof(T) == 1, uint8_t, std::conditional_t<sizeof(T) == 2, uint16_t,
+                     std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>>>;
+        constexpr Bits SIGN = Bits(1) << (8 * sizeof(T) - 1);
+
+        Bits bits;
+        if constexpr (std::is_floating_point_v<T>) {
+            /* As in the network NaNs go after every number and -0.0 equals 0.0 */
+            if (std::isnan(value)) bits = static_cast<Bits>(~Bits(0));
+            else {
+                bits = std::bit_cast<Bits>(value == 0 ? T(0) : value);
+                bits = bits & SIGN ? static_cast<Bits>(~bits) : static_cast<Bits>(bits | SIGN);
+            }
+        }
+        else if constexpr (std::is_signed_v<T>) bits = static_cast<Bits>(static_cast<Bits>(value) ^ SIGN);
+        else bits = static_cast<Bits>(value);
+
+        if (direction == DECREASING) bits = static_cast<Bits>(~bits);
+        return bits;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename... Columns>
+    template <typename Table>
+    uint64_t ColumnSorter<Columns...>::pack(const Table& table, const Group& group, const Directions& directions, size_t row) {
+        uint64_t key = 0;
+        [&]<size_t... I>(std::index_sequence<I...>) {
+            auto append = [&]<size_t Column>(std::integral_constant<size_t, Column>) {
+                if (Column >= group.first && Column < group.last)
+                    key = (BITS[Column] < 64 ? key << BITS[Column] : 0) | code(std::get<Column>(table)[row], directions[Column]);
+            };
+            (append(std::integral_constant<size_t, I> {}), ...);
+        }(std::make_index_sequence<COLUMNS> {});
+        return key;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename... Columns>
+    template <typename Key, typename Table>
+    void ColumnSorter<Columns...>::sortPass(BitonicSorter<Key>& sorter, const Table& table, const Group& group,
+                                            const Directions& directions, std::vector<uint32_t>& permutation) {
+        /* The keys of the rows in the current order, the first pass reads the table sequentially */
+        std::vector<Key> keys(permutation.size());
+        for (size_t i = 0; i < keys.size(); ++i) keys[i] = static_cast<Key>(pack(table, group, directions, permutation[i]));
+        sorter.sortByKey(keys.begin(), keys.end(), permutation.begin(), INCREASING);
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename... Columns>
+    std::vector<uint32_t> ColumnSorter<Columns...>::argsort(std::span<const Columns>... columns, const Directions& directions) {
+        std::array<size_t, COLUMNS> sizes {columns.size()...};
+        for (auto size: sizes)
+            if (size != sizes[0]) throw std::runtime_error("All columns have to be of the same size");
+
+        std::vector<uint32_t> permutation(sizes[0]);
+        std::iota(permutation.begin(), permutation.end(), 0u);
+
+        /* Least significant key first, a stable pass keeps the order of the later columns among its ties.
+           The directions are part of the codes, so every pass sorts increasing */
+        auto table = std::forward_as_tuple(columns...);
+        auto keys = groups();
+        for (auto group = keys.rbegin(); group != keys.rend(); ++group) {
+            if (group->bits <= 32) sortPass(narrow_, table, *group, directions, permutation);
+            else sortPass(wide_, table, *group, directions, permutation);
+        }
+        return permutation;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename... Columns>
+    void ColumnSorter<Columns...>::operator() (std::span<Columns>... columns, const Directions& directions) {
+        auto permutation = argsort(std::span<const Columns> {columns}..., directions);
+
+        /* One gather per column applies the row order */
+        auto apply = [&](auto column) {
+            std::vector<typename decltype(column)::value_type> sorted(column.size());
+            for (size_t i = 0; i < sorted.size(); ++i) sorted[i] = column[permutation[i]];
+            std::copy(sorted.begin(), sorted.end(), column.begin());
+        };
+        (apply(columns), ...);
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+};
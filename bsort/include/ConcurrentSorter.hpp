@@ -0,0 +1,193 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "BitonicSorter.hpp"
+
+
+namespace OpenCLApp {
+
+    /* Sorter that may be called from many host threads at once.
+       A BitonicSorter sets kernel arguments on its own cl::Kernel objects and owns its queues, so it serves one thread at a time.
+       This class keeps a pool of them on one SortEngine, which builds the context and the programs once, and leases
+       a sorter to every call. The lock only guards the pool, sorts of different threads run concurrently.
+       Sorters are created on demand, up to maxSorters, further callers wait for a sorter to be returned. */
+    template <typename T, size_t Width = KernelTypeTraits<T>::VECTOR_WIDTH>
+    class ConcurrentSorter final
+    {
+    public:
+        using Sorter = BitonicSorter<T, Width>;
+
+        class Lease final
+        {
+        private:
+            ConcurrentSorter*       owner_ = nullptr;
+            std::unique_ptr<Sorter> sorter_;
+
+        public:
+            Lease() = default;
+            Lease(ConcurrentSorter* owner, std::unique_ptr<Sorter> sorter) : owner_ {owner}, sorter_ {std::move(sorter)} {}
+            Lease(Lease&& other) noexcept = default;
+            Lease& operator= (Lease&& other) noexcept;
+            Lease(const Lease&) = delete;
+            Lease& operator= (const Lease&) = delete;
+            ~Lease() { if (sorter_) owner_->release(std::move(sorter_)); }
+
+            Sorter* operator-> () const { return sorter_.get(); }
+            Sorter& operator*  () const { return *sorter_; }
+        };
+
+    private:
+        SortEngine&                          engine_;
+        std::function<void(Sorter&)>         setup_;
+        size_t                               maxSorters_;
+        size_t                               created_ = 0;
+        std::vector<std::unique_ptr<Sorter>> idle_;
+        std::mutex                           mutex_;
+        std::condition_variable              available_;
+
+    public:
+        /* Setup configures every new sorter, e.g. its host threshold or stability */
+        ConcurrentSorter(SortEngine& engine, size_t maxSorters = std::thread::hardware_concurrency(),
+                         std::function<void(Sorter&)> setup = {});
+        ConcurrentSorter(std::string requiredPlatform, size_t maxSorters = std::thread::hardware_concurrency(),
+                         std::function<void(Sorter&)> setup = {});
+
+        /* Blocks while all maxSorters sorters are leased */
+        Lease acquire();
+        /* Creates sorters up front, so the first requests don't pay for their kernels and queues */
+        void reserve(size_t count);
+
+        size_t maxSorters() const noexcept { return maxSorters_; }
+        size_t sorters();
+
+        template <typename Iterator>
+        void operator() (Iterator begin, Iterator end, SortDirection direction = INCREASING) { (*acquire())(begin, end, direction); }
+        void operator() (std::span<T> data, SortDirection direction = INCREASING) { (*acquire())(data, direction); }
+
+        template <typename KeyIterator, typename ValueIterator>
+        void sortByKey(KeyIterator keysBegin, KeyIterator keysEnd, ValueIterator valuesBegin, SortDirection direction = INCREASING) {
+            acquire()->sortByKey(keysBegin, keysEnd, valuesBegin, direction);
+        }
+
+        template <typename Iterator>
+        std::vector<uint32_t> argsort(Iterator begin, Iterator end, SortDirection direction = INCREASING) {
+            return acquire()->argsort(begin, end, direction);
+        }
+
+        template <typename Iterator>
+        std::vector<T> topK(Iterator begin, Iterator end, size_t k, SortDirection direction = INCREASING) {
+            return acquire()->topK(begin, end, k, direction);
+        }
+
+    private:
+        std::unique_ptr<Sorter> create();
+        void release(std::unique_ptr<Sorter> sorter);
+    };
+
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    typename ConcurrentSorter<T, Width>::Lease& ConcurrentSorter<T, Width>::Lease::operator= (Lease&& other) noexcept {
+        if (this != &other) {
+            if (sorter_) owner_->release(std::move(sorter_));
+            owner_ = other.owner_;
+            sorter_ = std::move(other.sorter_);
+        }
+        return *this;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    ConcurrentSorter<T, Width>::ConcurrentSorter(SortEngine& engine, size_t maxSorters, std::function<void(Sorter&)> setup) :
+        engine_     {engine},
+        setup_      {std::move(setup)},
+        maxSorters_ {std::max<size_t>(maxSorters, 1)}
+        {
+            /* The first sorter builds the programs on the engine, the ones created later only make their kernels and queues */
+            reserve(1);
+        }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    ConcurrentSorter<T, Width>::ConcurrentSorter(std::string requiredPlatform, size_t maxSorters, std::function<void(Sorter&)> setup) :
+        ConcurrentSorter {SortEngine::instance(requiredPlatform), maxSorters, std::move(setup)}
+        {}
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    std::unique_ptr<BitonicSorter<T, Width>> ConcurrentSorter<T, Width>::create() {
+        /* Kernels and queues of the new sorter come from the engine's context and programs, nothing is built again */
+        auto sorter = std::make_unique<Sorter>(engine_);
+        if (setup_) setup_(*sorter);
+        return sorter;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    typename ConcurrentSorter<T, Width>::Lease ConcurrentSorter<T, Width>::acquire() {
+        {
+            std::unique_lock lock {mutex_};
+            available_.wait(lock, [&] { return !idle_.empty() || created_ < maxSorters_; });
+            if (!idle_.empty()) {
+                auto sorter = std::move(idle_.back());
+                idle_.pop_back();
+                return Lease {this, std::move(sorter)};
+            }
+            ++created_;
+        }
+
+        /* A new sorter is created outside the lock, other threads keep leasing the idle ones meanwhile */
+        try {
+            return Lease {this, create()};
+        }
+        catch (...) {
+            std::lock_guard lock {mutex_};
+            --created_;
+            available_.notify_one();
+            throw;
+        }
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    void ConcurrentSorter<T, Width>::release(std::unique_ptr<Sorter> sorter) {
+        {
+            std::lock_guard lock {mutex_};
+            idle_.push_back(std::move(sorter));
+        }
+        available_.notify_one();
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    void ConcurrentSorter<T, Width>::reserve(size_t count) {
+        std::vector<Lease> leases;
+        while (sorters() < std::min(count, maxSorters_)) leases.push_back(acquire());
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T, size_t Width>
+    size_t ConcurrentSorter<T, Width>::sorters() {
+        std::lock_guard lock {mutex_};
+        return created_;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+};
@@ -0,0 +1,234 @@
+#pragma once
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <queue>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "BitonicSorter.hpp"
+
+
+namespace OpenCLApp {
+
+    /* Sorts binary files of raw T values that don't fit in device or host memory.
+       The input is cut into runs that fit into one device buffer, every run is sorted on the device
+       while the next one is being read, and the sorted runs are spilled next to the output file.
+       A k-way merge then streams the runs into the output, prefetching the inputs and writing
+       the output in the background. */
+    template <typename T>
+    class ExternalSorter final
+    {
+    private:
+        BitonicSorter<T>&     sorter_;
+        size_t                runSize_;
+        size_t                blockSize_ = 1 << 20;
+        std::filesystem::path tempDirectory_;
+
+        class RunReader;
+
+    public:
+        /* The runs are merged on the host, so the sorter has to keep the natural order */
+        ExternalSorter(BitonicSorter<T>& sorter) : sorter_ {sorter}, runSize_ {sorter.maxSortSize()} {
+            if (!sorter.comparator().empty()) throw std::runtime_error("External sorting needs the natural order");
+        }
+
+        void sortFile(const std::filesystem::path& input, const std::filesystem::path& output, SortDirection direction = INCREASING);
+
+        size_t runSize() const noexcept { return runSize_; }
+        void setRunSize(size_t size) { runSize_ = std::clamp<size_t>(size, 1, sorter_.maxSortSize()); }
+        void setBlockSize(size_t size) { blockSize_ = std::max<size_t>(size, 1); }
+        void setTempDirectory(std::filesystem::path directory) { tempDirectory_ = std::move(directory); }
+
+    private:
+        std::vector<std::filesystem::path> spillRuns(const std::filesystem::path& input, const std::filesystem::path& output,
+                                                     SortDirection direction);
+        void mergeRuns(const std::vector<std::filesystem::path>& runs, const std::filesystem::path& output, SortDirection direction);
+
+        static size_t read(std::ifstream& file, std::vector<T>& data, size_t size);
+        static void write(const std::filesystem::path& path, std::span<const T> data);
+    };
+
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    class ExternalSorter<T>::RunReader final
+    {
+    private:
+        std::ifstream                  file_;
+        size_t                         blockSize_;
+        std::vector<T>                 block_;
+        size_t                         position_ = 0;
+        std::future<std::vector<T>>    next_;
+
+    public:
+        RunReader(const std::filesystem::path& path, size_t blockSize) : file_ {path, std::ios::binary}, blockSize_ {blockSize} {
+            if (!file_) throw std::runtime_error("Can't open run " + path.string());
+            next_ = std::async(std::launch::async, [this] { return readBlock(); });
+            refill();
+        }
+
+        bool empty() const noexcept { return position_ == block_.size(); }
+        const T& front() const noexcept { return block_[position_]; }
+
+        /* Returns false once the run is exhausted */
+        bool pop() {
+            if (++position_ < block_.size()) return true;
+            return refill();
+        }
+
+    private:
+        std::vector<T> readBlock() {
+            std::vector<T> block;
+            ExternalSorter::read(file_, block, blockSize_);
+            return block;
+        }
+
+        bool refill() {
+            /* Start reading the following block before the current one is consumed */
+            block_ = next_.get();
+            position_ = 0;
+            if (!block_.empty()) next_ = std::async(std::launch::async, [this] { return readBlock(); });
+            return !block_.empty();
+        }
+    };
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    size_t ExternalSorter<T>::read(std::ifstream& file, std::vector<T>& data, size_t size) {
+        data.resize(size);
+        file.read(reinterpret_cast<char*>(data.data()), size * sizeof(T));
+        data.resize(file.gcount() / sizeof(T));
+        return data.size();
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    void ExternalSorter<T>::write(const std::filesystem::path& path, std::span<const T> data) {
+        std::ofstream file {path, std::ios::binary | std::ios::trunc};
+        file.write(reinterpret_cast<const char*>(data.data()), data.size_bytes());
+        if (!file) throw std::runtime_error("Can't write " + path.string());
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    void ExternalSorter<T>::sortFile(const std::filesystem::path& input, const std::filesystem::path& output, SortDirection direction) {
+        if (std::filesystem::file_size(input) % sizeof(T))
+            throw std::runtime_error(input.string() + " doesn't hold a whole number of elements");
+
+        auto runs = spillRuns(input, output, direction);
+        if (runs.empty()) return;
+
+        try {
+            mergeRuns(runs, output, direction);
+        }
+        catch (...) {
+            for (auto& run: runs) std::filesystem::remove(run);
+            throw;
+        }
+        for (auto& run: runs) std::filesystem::remove(run);
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    std::vector<std::filesystem::path> ExternalSorter<T>::spillRuns(const std::filesystem::path& input, const std::filesystem::path& output,
+                                                                    SortDirection direction) {
+        std::ifstream file {input, std::ios::binary};
+        if (!file) throw std::runtime_error("Can't open " + input.string());
+
+        size_t elements = std::filesystem::file_size(input) / sizeof(T);
+        size_t count = (elements + runSize_ - 1) / runSize_;
+
+        std::vector<T> current, next;
+        read(file, current, std::min(runSize_, elements));
+
+        /* Inputs that fit into one run go straight to the output */
+        if (count <= 1) {
+            sorter_(std::span<T> {current}, direction);
+            write(output, current);
+            return {};
+        }
+
+        auto directory = tempDirectory_.empty() ? std::filesystem::absolute(output).parent_path() : tempDirectory_;
+        std::vector<std::filesystem::path> runs;
+        try {
+            for (size_t run = 0; run < count; ++run) {
+                /* Read the next run while the device sorts the current one */
+                auto sorted = sorter_.sortAsync(current, direction);
+                if (run + 1 < count) read(file, next, std::min(runSize_, elements - (run + 1) * runSize_));
+                sorted.get();
+
+                runs.push_back(directory / (output.filename().string() + ".run" + std::to_string(run)));
+                write(runs.back(), current);
+                std::swap(current, next);
+            }
+        }
+        catch (...) {
+            for (auto& run: runs) std::filesystem::remove(run);
+            throw;
+        }
+        return runs;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    void ExternalSorter<T>::mergeRuns(const std::vector<std::filesystem::path>& runs, const std::filesystem::path& output,
+                                      SortDirection direction) {
+        std::vector<std::unique_ptr<RunReader>> readers;
+        for (auto& run: runs) readers.push_back(std::make_unique<RunReader>(run, blockSize_));
+
+        /* The heap top is the run whose head goes first, ties keep the run order */
+        SortLess<T> less;
+        auto later = [&](size_t lhs, size_t rhs) {
+            const T& a = readers[lhs]->front();
+            const T& b = readers[rhs]->front();
+            if (direction == INCREASING ? less(b, a) : less(a, b)) return true;
+            if (direction == INCREASING ? less(a, b) : less(b, a)) return false;
+            return lhs > rhs;
+        };
+        std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heads {later};
+        for (size_t i = 0; i < readers.size(); ++i)
+            if (!readers[i]->empty()) heads.push(i);
+
+        std::ofstream file {output, std::ios::binary | std::ios::trunc};
+        if (!file) throw std::runtime_error("Can't open " + output.string());
+
+        /* Full blocks are written in the background while the next one is merged */
+        std::vector<T> block, written;
+        std::future<void> writing;
+        auto flush = [&] {
+            if (writing.valid()) writing.get();
+            std::swap(block, written);
+            block.clear();
+            writing = std::async(std::launch::async, [&] {
+                file.write(reinterpret_cast<const char*>(written.data()), written.size() * sizeof(T));
+                if (!file) throw std::runtime_error("Can't write " + output.string());
+            });
+        };
+
+        block.reserve(blockSize_);
+        while (!heads.empty()) {
+            size_t run = heads.top();
+            heads.pop();
+
+            block.push_back(readers[run]->front());
+            if (readers[run]->pop()) heads.push(run);
+            if (block.size() == blockSize_) flush();
+        }
+
+        flush();
+        writing.get();
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+};
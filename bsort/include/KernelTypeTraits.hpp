@@ -0,0 +1,239 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include "SortTypes.hpp"
+
+#define CL_HPP_TARGET_OPENCL_VERSION 220
+#define CL_HPP_ENABLE_EXCEPTIONS
+
+#ifdef MAC
+    #include <OpenCL/cl.hpp>
+#else
+    #include <CL/opencl.hpp>
+#endif
+
+
+namespace OpenCLApp {
+
+    /* OpenCL spelling of a key type, from which the build options of bsort.cl are put together.
+       Vector types are the scalar names with the vector width appended, so one table serves every width.
+       Types without a specialization can't be sorted. */
+    template <typename T>
+    struct KernelTypeTraits;
+
+    /* Defaults shared by the specializations: keys are sorted as they are, values are 32-bit.
+       Floating keys sort NaNs after every number, so MAX is NaN for them */
+    template <typename K, typename V = cl_uint>
+    struct KernelTypeBase
+    {
+        using Key   = K;
+        using Value = V;
+
+        /* Narrow types take wider vectors, so a vector holds 16 bytes at least */
+        static constexpr size_t VECTOR_WIDTH = std::max<size_t>(4, 16 / sizeof(Key));
+
+        static constexpr std::string_view VALUE      = "uint";
+        static constexpr std::string_view VALUE_MASK = "int";
+        static constexpr std::string_view VALUE_MAX  = "UINT_MAX";
+        static constexpr std::string_view OPTIONS    = "";
+
+        /* Unsigned type of the key bits for radix.cl, empty where the radix sort doesn't apply */
+        static constexpr std::string_view RADIX_BITS = "";
+    };
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <>
+    struct KernelTypeTraits<float> : KernelTypeBase<float>
+    {
+        static constexpr std::string_view SCALAR     = "float";
+        static constexpr std::string_view COMPARATOR = "int";
+        static constexpr std::string_view MASK       = "uint";
+        static constexpr std::string_view MAX        = "NAN";
+        static constexpr std::string_view MIN        = "-INFINITY";
+        static constexpr std::string_view OPTIONS    = "-DKEY_FLOAT";
+        static constexpr cl_device_info PREFERRED_WIDTH = CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT;
+        static constexpr std::string_view RADIX_BITS = "uint";
+    };
+
+    template <>
+    struct KernelTypeTraits<double> : KernelTypeBase<double>
+    {
+        static constexpr std::string_view SCALAR     = "double";
+        static constexpr std::string_view COMPARATOR = "long";
+        static constexpr std::string_view MASK       = "ulong";
+        static constexpr std::string_view MAX        = "NAN";
+        static constexpr std::string_view MIN        = "-INFINITY";
+        static constexpr std::string_view OPTIONS    = "-DKEY_FLOAT";
+        static constexpr cl_device_info PREFERRED_WIDTH = CL_DEVICE_PREFERRED_VECTOR_WIDTH_DOUBLE;
+        static constexpr std::string_view RADIX_BITS = "ulong";
+    };
+
+    template <>
+    struct KernelTypeTraits<Half> : KernelTypeBase<Half>
+    {
+        /* Needs cl_khr_fp16, the build fails on devices without it */
+        static constexpr std::string_view SCALAR     = "half";
+        static constexpr std::string_view COMPARATOR = "short";
+        static constexpr std::string_view MASK       = "ushort";
+        static constexpr std::string_view MAX        = "NAN";
+        static constexpr std::string_view MIN        = "-INFINITY";
+        static constexpr std::string_view OPTIONS    = "-DKEY_FLOAT";
+        static constexpr cl_device_info PREFERRED_WIDTH = CL_DEVICE_PREFERRED_VECTOR_WIDTH_HALF;
+    };
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <>
+    struct KernelTypeTraits<int8_t> : KernelTypeBase<int8_t>
+    {
+        static constexpr std::string_view SCALAR     = "char";
+        static constexpr std::string_view COMPARATOR = "char";
+        static constexpr std::string_view MASK       = "uchar";
+        static constexpr std::string_view MAX        = "CHAR_MAX";
+        static constexpr std::string_view MIN        = "CHAR_MIN";
+        static constexpr cl_device_info PREFERRED_WIDTH = CL_DEVICE_PREFERRED_VECTOR_WIDTH_CHAR;
+    };
+
+    template <>
+    struct KernelTypeTraits<uint8_t> : KernelTypeBase<uint8_t>
+    {
+        static constexpr std::string_view SCALAR     = "uchar";
+        static constexpr std::string_view COMPARATOR = "char";
+        static constexpr std::string_view MASK       = "uchar";
+        static constexpr std::string_view MAX        = "UCHAR_MAX";
+        static constexpr std::string_view MIN        = "0";
+        static constexpr cl_device_info PREFERRED_WIDTH = CL_DEVICE_PREFERRED_VECTOR_WIDTH_CHAR;
+    };
+
+    template <>
+    struct KernelTypeTraits<int16_t> : KernelTypeBase<int16_t>
+    {
+        static constexpr std::string_view SCALAR     = "short";
+        static constexpr std::string_view COMPARATOR = "short";
+        static constexpr std::string_view MASK       = "ushort";
+        static constexpr std::string_view MAX        = "SHRT_MAX";
+        static constexpr std::string_view MIN        = "SHRT_MIN";
+        static constexpr cl_device_info PREFERRED_WIDTH = CL_DEVICE_PREFERRED_VECTOR_WIDTH_SHORT;
+    };
+
+    template <>
+    struct KernelTypeTraits<uint16_t> : KernelTypeBase<uint16_t>
+    {
+        static constexpr std::string_view SCALAR     = "ushort";
+        static constexpr std::string_view COMPARATOR = "short";
+        static constexpr std::string_view MASK       = "ushort";
+        static constexpr std::string_view MAX        = "USHRT_MAX";
+        static constexpr std::string_view MIN        = "0";
+        static constexpr cl_device_info PREFERRED_WIDTH = CL_DEVICE_PREFERRED_VECTOR_WIDTH_SHORT;
+    };
+
+    template <>
+    struct KernelTypeTraits<int32_t> : KernelTypeBase<int32_t>
+    {
+        static constexpr std::string_view SCALAR     = "int";
+        static constexpr std::string_view COMPARATOR = "int";
+        static constexpr std::string_view MASK       = "uint";
+        static constexpr std::string_view MAX        = "INT_MAX";
+        static constexpr std::string_view MIN        = "INT_MIN";
+        static constexpr cl_device_info PREFERRED_WIDTH = CL_DEVICE_PREFERRED_VECTOR_WIDTH_INT;
+        static constexpr std::string_view RADIX_BITS = "uint";
+    };
+
+    template <>
+    struct KernelTypeTraits<uint32_t> : KernelTypeBase<uint32_t>
+    {
+        static constexpr std::string_view SCALAR     = "uint";
+        static constexpr std::string_view COMPARATOR = "int";
+        static constexpr std::string_view MASK       = "uint";
+        static constexpr std::string_view MAX        = "UINT_MAX";
+        static constexpr std::string_view MIN        = "0";
+        static constexpr cl_device_info PREFERRED_WIDTH = CL_DEVICE_PREFERRED_VECTOR_WIDTH_INT;
+        static constexpr std::string_view RADIX_BITS = "uint";
+    };
+
+    template <>
+    struct KernelTypeTraits<int64_t> : KernelTypeBase<int64_t>
+    {
+        static constexpr std::string_view SCALAR     = "long";
+        static constexpr std::string_view COMPARATOR = "long";
+        static constexpr std::string_view MASK       = "ulong";
+        static constexpr std::string_view MAX        = "LONG_MAX";
+        static constexpr std::string_view MIN        = "LONG_MIN";
+        static constexpr cl_device_info PREFERRED_WIDTH = CL_DEVICE_PREFERRED_VECTOR_WIDTH_LONG;
+        static constexpr std::string_view RADIX_BITS = "ulong";
+    };
+
+    template <>
+    struct KernelTypeTraits<uint64_t> : KernelTypeBase<uint64_t>
+    {
+        static constexpr std::string_view SCALAR     = "ulong";
+        static constexpr std::string_view COMPARATOR = "long";
+        static constexpr std::string_view MASK       = "ulong";
+        static constexpr std::string_view MAX        = "ULONG_MAX";
+        static constexpr std::string_view MIN        = "0";
+        static constexpr cl_device_info PREFERRED_WIDTH = CL_DEVICE_PREFERRED_VECTOR_WIDTH_LONG;
+        static constexpr std::string_view RADIX_BITS = "ulong";
+    };
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <>
+    struct KernelTypeTraits<UInt128> : KernelTypeTraits<uint64_t>
+    {
+        /* High halves are the keys and low halves their values, ties between keys are broken by the values */
+        using Value = uint64_t;
+
+        static constexpr std::string_view VALUE      = "ulong";
+        static constexpr std::string_view VALUE_MASK = "long";
+        static constexpr std::string_view VALUE_MAX  = "ULONG_MAX";
+        static constexpr std::string_view OPTIONS    = "-DLEXICOGRAPHIC";
+        static constexpr std::string_view RADIX_BITS = "";
+    };
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    /* Build options that instantiate bsort.cl for T with the given vector width */
+    template <typename T>
+    std::string kernelOptions(size_t width) {
+        using Traits = KernelTypeTraits<T>;
+        auto vector = [width](std::string_view scalar) { return std::string {scalar} + std::to_string(width); };
+
+        std::string options;
+        options += "-DTYPE="            + vector(Traits::SCALAR);
+        options += " -DCOMPORATOR_TYPE=" + vector(Traits::COMPARATOR);
+        options += " -DMASK_TYPE="      + vector(Traits::MASK);
+        options += " -DVECTOR_WIDTH="   + std::to_string(width);
+        options += " -DSCALAR_TYPE="    + std::string {Traits::SCALAR};
+        options += " -DTYPE_MAX="       + std::string {Traits::MAX};
+        options += " -DTYPE_MIN="       + std::string {Traits::MIN};
+        options += " -DVALUE_TYPE="     + std::string {Traits::VALUE};
+        options += " -DVALUE_CAST=convert_" + vector(Traits::VALUE_MASK);
+        options += " -DVALUE_MAX="      + std::string {Traits::VALUE_MAX};
+        options += " -DVALUE_MIN=0";
+        if (!Traits::OPTIONS.empty()) options += " " + std::string {Traits::OPTIONS};
+        return options;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    /* Build options that instantiate radix.cl for T, which needs a non-empty RADIX_BITS */
+    template <typename T>
+    std::string radixOptions() {
+        using Traits = KernelTypeTraits<T>;
+
+        std::string options;
+        options += "-DKEY_TYPE="  + std::string {Traits::SCALAR};
+        options += " -DBITS_TYPE=" + std::string {Traits::RADIX_BITS};
+        if constexpr (std::is_floating_point_v<T>) options += " -DKEY_FLOAT";
+        else if constexpr (std::is_signed_v<T>) options += " -DKEY_SIGNED";
+        return options;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+};
@@ -0,0 +1,206 @@
+#pragma once
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <string>
+
+#ifdef _WIN32
+    #include <process.h>
+#else
+    #include <unistd.h>
+#endif
+
+#define CL_HPP_TARGET_OPENCL_VERSION 220
+#define CL_HPP_ENABLE_EXCEPTIONS
+
+#ifdef MAC
+    #include <OpenCL/cl.hpp>
+#else
+    #include <CL/opencl.hpp>
+#endif
+
+
+namespace OpenCLApp {
+
+    /* On-disk cache of built program binaries, one file per device.
+       An entry is keyed by device name, driver version, build options and a hash of the source,
+       so a driver update or an edited kernel simply misses the cache and triggers a source build.
+       The directory is taken from BSORT_CACHE_DIR, or the system temp directory, unless set explicitly.
+       An empty directory disables the cache. */
+    class ProgramCache final
+    {
+    public:
+        static void setDirectory(std::filesystem::path directory);
+        static std::filesystem::path directory();
+
+        static cl::Program build(const cl::Context& context, const cl::vector<cl::Device>& devices,
+                                 const std::string& source, const std::string& options);
+
+        /* Creates an empty file with a unique name next to target, like mkstemp, or returns an empty path */
+        static std::filesystem::path createTemp(const std::filesystem::path& target);
+
+    private:
+        static std::filesystem::path& directoryStorage();
+        static std::string key(const cl::Device& device, const std::string& source, const std::string& options);
+        static std::filesystem::path entry(const std::string& key);
+
+        static bool load(const std::string& key, cl::Program::Binaries::value_type& binary);
+        static void store(const std::string& key, const cl::Program::Binaries::value_type& binary);
+    };
+
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline std::filesystem::path& ProgramCache::directoryStorage() {
+        static std::filesystem::path directory = [] {
+            if (auto env = std::getenv("BSORT_CACHE_DIR")) return std::filesystem::path {env};
+
+            std::error_code error;
+            auto temp = std::filesystem::temp_directory_path(error);
+            return error ? std::filesystem::path {} : temp / "bsort-cache";
+        }();
+        return directory;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline void ProgramCache::setDirectory(std::filesystem::path directory) {
+        directoryStorage() = std::move(directory);
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline std::filesystem::path ProgramCache::directory() {
+        return directoryStorage();
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline std::string ProgramCache::key(const cl::Device& device, const std::string& source, const std::string& options) {
+        std::ostringstream key;
+        key << device.getInfo<CL_DEVICE_NAME>() << '|' << device.getInfo<CL_DRIVER_VERSION>() << '|'
+            << options << '|' << std::hex << std::hash<std::string> {}(source);
+        return key.str();
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline std::filesystem::path ProgramCache::entry(const std::string& key) {
+        std::ostringstream name;
+        name << std::hex << std::hash<std::string> {}(key) << ".bin";
+        return directory() / name.str();
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline bool ProgramCache::load(const std::string& key, cl::Program::Binaries::value_type& binary) {
+        std::ifstream file {entry(key), std::ios::binary};
+        if (!file) return false;
+
+        /* The full key is stored in front of the binary to rule out file name collisions */
+        std::string storedKey;
+        if (!std::getline(file, storedKey) || storedKey != key) return false;
+
+        binary.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        return !binary.empty();
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline std::filesystem::path ProgramCache::createTemp(const std::filesystem::path& target) {
+#ifdef _WIN32
+        auto pid = _getpid();
+#else
+        auto pid = getpid();
+#endif
+        /* The pid tells processes apart, the random suffix threads of one process. Mode "x" fails on an existing file */
+        thread_local std::mt19937_64 gen {std::random_device {}()};
+        for (int attempt = 0; attempt < 16; ++attempt) {
+            auto temp = target;
+            temp += "." + std::to_string(pid) + "." + std::to_string(gen()) + ".tmp";
+            if (auto file = std::fopen(temp.string().c_str(), "wbx")) {
+                std::fclose(file);
+                return temp;
+            }
+        }
+        return {};
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline void ProgramCache::store(const std::string& key, const cl::Program::Binaries::value_type& binary) {
+        std::error_code error;
+        std::filesystem::create_directories(directory(), error);
+        if (error) return;
+
+        /* Write to a temporary file first so concurrent processes never read a partial entry */
+        auto path = entry(key);
+        auto temp = createTemp(path);
+        if (temp.empty()) return;
+        std::ofstream file {temp, std::ios::binary};
+        file << key << '\n';
+        file.write(reinterpret_cast<const char*>(binary.data()), binary.size());
+        file.close();
+        if (!file) {
+            std::filesystem::remove(temp, error);
+            return;
+        }
+        std::filesystem::rename(temp, path, error);
+        if (error) std::filesystem::remove(temp, error);
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline cl::Program ProgramCache::build(const cl::Context& context, const cl::vector<cl::Device>& devices,
+                                           const std::string& source, const std::string& options) {
+        bool enabled = !directory().empty();
+
+        cl::Program::Binaries binaries(devices.size());
+        bool cached = enabled;
+        for (size_t i = 0; cached && i < devices.size(); ++i)
+            cached = load(key(devices[i], source, options), binaries[i]);
+
+        if (cached) {
+            /* A stale or corrupted binary is rejected by the driver, then we rebuild from source */
+            try {
+                cl::Program program {context, devices, binaries};
+                program.build(devices, options.c_str());
+                return program;
+            }
+            catch (cl::Error&) {}
+        }
+
+        cl::Program program {context, cl::Program::Sources {source}};
+        try {
+            program.build(devices, options.c_str());
+        }
+        catch (cl::Error& error) {
+            if (error.err() == CL_BUILD_PROGRAM_FAILURE) {
+                for (auto& dev: devices) {
+                    if (program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(dev) != CL_BUILD_ERROR) continue;
+                    std::cerr << "Build log for " << dev.getInfo<CL_DEVICE_NAME>() << ":" << std::endl
+                              << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(dev) << std::endl;
+                }
+            }
+            throw;
+        }
+
+        if (enabled) {
+            /* Binaries come in the order of CL_PROGRAM_DEVICES, which may differ from the requested one */
+            auto built = program.getInfo<CL_PROGRAM_BINARIES>();
+            auto owners = program.getInfo<CL_PROGRAM_DEVICES>();
+            for (size_t i = 0; i < owners.size() && i < built.size(); ++i)
+                if (!built[i].empty()) store(key(owners[i], source, options), built[i]);
+        }
+        return program;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+};
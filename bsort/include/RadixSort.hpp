@@ -0,0 +1,135 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <climits>
+#include <cstddef>
+#include <utility>
+#include "KernelTypeTraits.hpp"
+#include "SortEngine.hpp"
+
+#define CL_HPP_TARGET_OPENCL_VERSION 220
+#define CL_HPP_ENABLE_EXCEPTIONS
+
+#ifdef MAC
+    #include <OpenCL/cl.hpp>
+#else
+    #include <CL/opencl.hpp>
+#endif
+
+
+namespace OpenCLApp {
+
+    /* LSD radix sort of 32- and 64-bit keys on the device, see radix.cl.
+       Every pass sorts the keys stably by RADIX_BITS bits into a scratch buffer of the same size,
+       the number of passes is even, so the keys end up in the buffer they came from.
+       The scratch buffer is reused by every sort, so all of them have to go to one in-order queue.
+       The work is linear in the number of keys, which beats the bitonic network on large arrays. */
+    template <typename T>
+    class RadixSort final
+    {
+    public:
+        static constexpr bool SUPPORTED = !KernelTypeTraits<T>::RADIX_BITS.empty();
+
+        /* Must match radix.cl */
+        static constexpr size_t RADIX_BITS = 4;
+        static constexpr size_t RADIX      = size_t(1) << RADIX_BITS;
+        static constexpr size_t PASSES     = sizeof(T) * CHAR_BIT / RADIX_BITS;
+        static_assert(PASSES % 2 == 0, "The sorted keys have to end up in the input buffer");
+
+        /* Work-groups per compute unit, each one walks a contiguous range of the keys */
+        static constexpr size_t GROUPS_PER_UNIT = 4;
+
+    private:
+        cl::Context context_;
+        cl::Program program_;
+        cl::KernelFunctor<cl::Buffer, cl::Buffer, cl::LocalSpaceArg, unsigned, unsigned, int> histogram_;
+        cl::KernelFunctor<cl::Buffer, cl::LocalSpaceArg, unsigned>                            scan_;
+        cl::KernelFunctor<cl::Buffer, cl::Buffer, cl::Buffer, cl::LocalSpaceArg, cl::LocalSpaceArg, cl::LocalSpaceArg,
+                          unsigned, unsigned, int>                                           scatter_;
+        size_t     localSize_;
+        size_t     groups_;
+        cl::Buffer counts_;
+        cl::Buffer scratch_;
+        size_t     capacity_ = 0;
+
+    public:
+        RadixSort(SortEngine& engine);
+
+        /* Record is called with the stage, the shift and the event of every launch */
+        template <typename Record>
+        void sortBuffer(cl::CommandQueue& queue, cl::Buffer& keys, size_t size, int direction, Record&& record);
+
+        void releaseScratch();
+
+    private:
+        size_t initLocalSize(const cl::Device& device);
+    };
+
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    RadixSort<T>::RadixSort(SortEngine& engine) :
+        context_   {engine.context()},
+        program_   {engine.program(radixOptions<T>(), RADIX_SOURCE)},
+        histogram_ {program_, "radix_histogram"},
+        scan_      {program_, "radix_scan"},
+        scatter_   {program_, "radix_scatter"},
+        localSize_ {initLocalSize(engine.devices()[0])},
+        groups_    {GROUPS_PER_UNIT * engine.devices()[0].getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>()},
+        counts_    {context_, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, RADIX * groups_ * sizeof(cl_uint)}
+        {}
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    size_t RadixSort<T>::initLocalSize(const cl::Device& device) {
+        /* The scatter keeps RADIX ranks per work-item in local memory, a tile of 256 keys is plenty */
+        size_t size = 256;
+        for (auto kernel: {histogram_.getKernel(), scan_.getKernel(), scatter_.getKernel()})
+            size = std::min<size_t>(size, kernel.template getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+        size = std::min<size_t>(size, device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>() / ((RADIX + 1) * sizeof(cl_uint)) - 1);
+        return std::bit_floor(std::max<size_t>(size, 1));
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    template <typename Record>
+    void RadixSort<T>::sortBuffer(cl::CommandQueue& queue, cl::Buffer& keys, size_t size, int direction, Record&& record) {
+        if (capacity_ < size) {
+            scratch_ = cl::Buffer {context_, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, size * sizeof(T)};
+            capacity_ = size;
+        }
+
+        /* Small arrays take fewer work-groups, so none of them is left without keys */
+        size_t groups = std::clamp<size_t>((size + localSize_ - 1) / localSize_, 1, groups_);
+        cl::EnqueueArgs groupArgs {queue, groups * localSize_, localSize_};
+        cl::EnqueueArgs scanArgs {queue, localSize_, localSize_};
+
+        auto counts = cl::Local(RADIX * sizeof(cl_uint));
+        auto ranks = cl::Local(RADIX * localSize_ * sizeof(cl_uint));
+        auto sums = cl::Local(localSize_ * sizeof(cl_uint));
+
+        cl::Buffer* input = &keys;
+        cl::Buffer* output = &scratch_;
+        for (size_t shift = 0; shift < sizeof(T) * CHAR_BIT; shift += RADIX_BITS) {
+            record("radix_histogram", shift, histogram_(groupArgs, *input, counts_, counts, size, shift, direction));
+            record("radix_scan", shift, scan_(scanArgs, counts_, sums, RADIX * groups));
+            record("radix_scatter", shift, scatter_(groupArgs, *input, *output, counts_, ranks, sums, counts, size, shift, direction));
+            std::swap(input, output);
+        }
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    void RadixSort<T>::releaseScratch() {
+        /* Sorts still in flight keep their own reference to the buffer */
+        scratch_ = cl::Buffer {};
+        capacity_ = 0;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+};
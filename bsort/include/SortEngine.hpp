@@ -0,0 +1,159 @@
+#pragma once
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "KernelTypeTraits.hpp"
+#include "ProgramCache.hpp"
+#include "bsortSource.h"
+#include "radixSource.h"
+
+#define CL_HPP_TARGET_OPENCL_VERSION 220
+#define CL_HPP_ENABLE_EXCEPTIONS
+
+#ifdef MAC
+    #include <OpenCL/cl.hpp>
+#else
+    #include <CL/opencl.hpp>
+#endif
+
+
+namespace OpenCLApp {
+
+    template <typename T, size_t Width = KernelTypeTraits<T>::VECTOR_WIDTH>
+    class BitonicSorter;
+
+    /* Process-wide owner of the platform, the context and the built programs.
+       One engine exists per requested platform, and every sorter on that platform shares it,
+       so platform discovery and compilation happen once per process and build options.
+       Sorters keep their own queues, kernels and buffers, so each thread should use its own sorter, see ConcurrentSorter.
+       An engine may split its first device into equal sub-devices, which sorters then use as separate devices. */
+    class SortEngine final
+    {
+    private:
+        cl::vector<cl::Device>             devices_;
+        cl::Platform                       platform_;
+        cl::Context                        context_;
+        std::mutex                         mutex_;
+        std::map<std::tuple<const char*, std::string, std::string>, cl::Program> programs_;
+
+        SortEngine(const std::string& requiredPlatform, unsigned subDevices);
+
+    public:
+        SortEngine(const SortEngine&) = delete;
+        SortEngine& operator= (const SortEngine&) = delete;
+
+        static SortEngine& instance(const std::string& requiredPlatform, unsigned subDevices = 0);
+
+        const cl::vector<cl::Device>& devices()  const noexcept { return devices_; }
+        const cl::Platform&           platform() const noexcept { return platform_; }
+        const cl::Context&            context()  const noexcept { return context_; }
+
+        /* The prelude is spliced in ahead of the source, e.g. a custom order of bsort.cl */
+        cl::Program program(const std::string& options, const char* source = BSORT_SOURCE, const std::string& prelude = {});
+
+        template <typename T, size_t Width = KernelTypeTraits<T>::VECTOR_WIDTH>
+        BitonicSorter<T, Width> sorter();
+
+    private:
+        cl::Platform FindPlatform(const cl::vector<cl::Platform>& platforms, std::string platform_name);
+        void InitDevices(const cl::Platform& platform, cl::vector<cl::Device>& devices);
+        void PartitionDevice(unsigned subDevices);
+    };
+
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline SortEngine::SortEngine(const std::string& requiredPlatform, unsigned subDevices) :
+        platform_ {[&] {
+            cl::vector<cl::Platform> platforms;
+            cl::Platform::get(&platforms);
+            auto platform = FindPlatform(platforms, requiredPlatform);
+            if (subDevices > 1) PartitionDevice(subDevices);
+            return platform;
+        }()},
+        context_  {devices_}
+        {}
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline SortEngine& SortEngine::instance(const std::string& requiredPlatform, unsigned subDevices) {
+        static std::mutex mutex;
+        static std::map<std::pair<std::string, unsigned>, std::unique_ptr<SortEngine>> engines;
+
+        std::lock_guard lock {mutex};
+        auto& engine = engines[{requiredPlatform, subDevices > 1 ? subDevices : 0}];
+        if (!engine) engine.reset(new SortEngine {requiredPlatform, subDevices});
+        return *engine;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline cl::Program SortEngine::program(const std::string& options, const char* source, const std::string& prelude) {
+        /* Sources are the embedded kernel files, so their addresses tell them apart */
+        std::lock_guard lock {mutex_};
+        auto key = std::make_tuple(source, options, prelude);
+        auto it = programs_.find(key);
+        if (it == programs_.end()) {
+            auto text = prelude.empty() ? std::string {source} : prelude + "\n" + source;
+            it = programs_.emplace(key, ProgramCache::build(context_, devices_, text, options)).first;
+        }
+        return it->second;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline cl::Platform SortEngine::FindPlatform(const cl::vector<cl::Platform>& platforms, std::string platform_name) {
+
+        auto platform_it = std::find_if(platforms.begin(), platforms.end(), [&](cl::Platform platform) {
+            auto pl_name = platform.getInfo<CL_PLATFORM_NAME>();
+            return pl_name.find(platform_name) != pl_name.npos;
+        });
+
+        if (platform_it != platforms.end()) {
+            InitDevices(*platform_it, devices_);
+            return *platform_it;
+        }
+        else throw std::runtime_error("Can't find platform " + platform_name);
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline void SortEngine::InitDevices(const cl::Platform& platform, cl::vector<cl::Device>& devices) {
+        try {
+          platform.getDevices(CL_DEVICE_TYPE_GPU, &devices);
+        }
+        catch (cl::Error& error) {
+            platform.getDevices(CL_DEVICE_TYPE_CPU, &devices);
+        }
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline void SortEngine::PartitionDevice(unsigned subDevices) {
+        /* Throws if the device can't be partitioned, e.g. on most GPUs */
+        auto units = devices_[0].getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+        if (units < subDevices) throw std::runtime_error("Can't split " + std::to_string(units) + " compute units into "
+                                                         + std::to_string(subDevices) + " sub-devices");
+
+        /* PARTITION_EQUALLY takes the units per sub-device, so it would make as many sub-devices as fit.
+           Counts give exactly subDevices of them, the leftover units go one each to the first ones */
+        std::vector<cl_device_partition_property> properties {CL_DEVICE_PARTITION_BY_COUNTS};
+        for (unsigned i = 0; i < subDevices; ++i)
+            properties.push_back(static_cast<cl_device_partition_property>(units / subDevices + (i < units % subDevices)));
+        properties.push_back(CL_DEVICE_PARTITION_BY_COUNTS_LIST_END);
+        properties.push_back(0);
+
+        cl::vector<cl::Device> parts;
+        devices_[0].createSubDevices(properties.data(), &parts);
+        devices_ = parts;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+};
@@ -0,0 +1,144 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iomanip>
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define CL_HPP_TARGET_OPENCL_VERSION 220
+#define CL_HPP_ENABLE_EXCEPTIONS
+
+#ifdef MAC
+    #include <OpenCL/cl.hpp>
+#else
+    #include <CL/opencl.hpp>
+#endif
+
+
+namespace OpenCLApp {
+
+    /* Device timestamps of one kernel launch or transfer, in nanoseconds of the device clock.
+       Stride is the merge distance in vectors of a flip or merge launch and zero for the other stages */
+    struct CommandTimes {
+        std::string stage;
+        size_t      stride = 0;
+        size_t      size   = 0;
+        size_t      device = 0;
+        cl_ulong    queued = 0;
+        cl_ulong    submit = 0;
+        cl_ulong    start  = 0;
+        cl_ulong    end    = 0;
+    };
+
+    /* Execution time of all recorded commands of one stage and stride */
+    struct StageStats {
+        std::string              stage;
+        size_t                   stride   = 0;
+        size_t                   launches = 0;
+        std::chrono::nanoseconds total    {0};
+        std::chrono::nanoseconds min      {std::chrono::nanoseconds::max()};
+        std::chrono::nanoseconds max      {0};
+    };
+
+    /* Events of the commands a profiling sorter enqueues. Timestamps are read lazily,
+       so recording costs nothing but keeping the event until clear() */
+    class SortProfile final
+    {
+    public:
+        void record(std::string stage, size_t stride, size_t size, size_t device, const cl::Event& event);
+        void clear() noexcept { pending_.clear(); }
+        bool empty() const noexcept { return pending_.empty(); }
+
+        std::vector<CommandTimes> commands() const;
+        std::vector<StageStats> stats() const;
+        void writeChromeTrace(std::ostream& output) const;
+
+    private:
+        struct Pending {
+            std::string stage;
+            size_t      stride;
+            size_t      size;
+            size_t      device;
+            cl::Event   event;
+        };
+        std::vector<Pending> pending_;
+    };
+
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline void SortProfile::record(std::string stage, size_t stride, size_t size, size_t device, const cl::Event& event) {
+        if (event()) pending_.push_back({std::move(stage), stride, size, device, event});
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline std::vector<CommandTimes> SortProfile::commands() const {
+        /* Waits for commands still in flight, timestamps are only valid once a command completes */
+        std::vector<CommandTimes> commands;
+        commands.reserve(pending_.size());
+        for (auto& command: pending_) {
+            command.event.wait();
+            commands.push_back({command.stage, command.stride, command.size, command.device,
+                                command.event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>(),
+                                command.event.getProfilingInfo<CL_PROFILING_COMMAND_SUBMIT>(),
+                                command.event.getProfilingInfo<CL_PROFILING_COMMAND_START>(),
+                                command.event.getProfilingInfo<CL_PROFILING_COMMAND_END>()});
+        }
+        return commands;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline std::vector<StageStats> SortProfile::stats() const {
+        std::map<std::pair<std::string, size_t>, StageStats> groups;
+        for (auto& command: commands()) {
+            auto& group = groups[{command.stage, command.stride}];
+            std::chrono::nanoseconds time {command.end - command.start};
+            group.stage = command.stage;
+            group.stride = command.stride;
+            ++group.launches;
+            group.total += time;
+            group.min = std::min(group.min, time);
+            group.max = std::max(group.max, time);
+        }
+
+        /* Most expensive stages first */
+        std::vector<StageStats> stats;
+        for (auto& [key, group]: groups) stats.push_back(group);
+        std::sort(stats.begin(), stats.end(), [](auto& lhs, auto& rhs) { return lhs.total > rhs.total; });
+        return stats;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline void SortProfile::writeChromeTrace(std::ostream& output) const {
+        /* Trace Event Format as read by chrome://tracing and Perfetto: one complete event per command,
+           one thread per device, microseconds counted from the first queued command */
+        auto commands = this->commands();
+        cl_ulong origin = commands.empty() ? 0 : commands.front().queued;
+        for (auto& command: commands) origin = std::min(origin, command.queued);
+
+        auto micro = [](cl_ulong nanoseconds) { return static_cast<double>(nanoseconds) / 1000; };
+
+        auto flags = output.flags();
+        output << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+        for (size_t i = 0; i < commands.size(); ++i) {
+            auto& command = commands[i];
+            output << (i ? ",\n" : "\n")
+                   << "{\"name\":\"" << command.stage << "\",\"cat\":\"bsort\",\"ph\":\"X\",\"pid\":0,\"tid\":" << command.device
+                   << ",\"ts\":" << micro(command.start - origin) << ",\"dur\":" << micro(command.end - command.start)
+                   << ",\"args\":{\"stride\":" << command.stride << ",\"size\":" << command.size
+                   << ",\"queued_us\":" << micro(command.queued - origin) << ",\"submit_us\":" << micro(command.submit - origin) << "}}";
+        }
+        output << "\n],\"displayTimeUnit\":\"ms\"}\n";
+        output.flags(flags);
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+};
@@ -0,0 +1,113 @@
+#pragma once
+#include <bit>
+#include <cmath>
+#include <compare>
+#include <cstdint>
+#include <type_traits>
+
+#define CL_HPP_TARGET_OPENCL_VERSION 220
+#define CL_HPP_ENABLE_EXCEPTIONS
+
+#ifdef MAC
+    #include <OpenCL/cl.hpp>
+#else
+    #include <CL/opencl.hpp>
+#endif
+
+
+namespace OpenCLApp {
+
+    /* IEEE 754 half precision key. cl_half is a plain 16-bit integer, so it can't tell BitonicSorter
+       that the bits hold a float, this wrapper does. The host side compares through float. */
+    struct Half
+    {
+        cl_half bits = 0;
+
+        constexpr Half() = default;
+        explicit Half(float value) : bits {fromFloat(value)} {}
+
+        operator float() const { return toFloat(bits); }
+
+        friend bool operator== (Half lhs, Half rhs) { return float(lhs) == float(rhs); }
+        friend std::partial_ordering operator<=> (Half lhs, Half rhs) { return float(lhs) <=> float(rhs); }
+
+        static cl_half fromFloat(float value);
+        static float toFloat(cl_half bits);
+    };
+
+    /* Unsigned 128-bit key. The device sorts the high halves as keys and the low halves as their values,
+       breaking ties between equal high halves by the low ones. */
+    struct UInt128
+    {
+        uint64_t hi = 0;
+        uint64_t lo = 0;
+
+        constexpr UInt128() = default;
+        constexpr UInt128(uint64_t high, uint64_t low) : hi {high}, lo {low} {}
+        constexpr explicit UInt128(uint64_t low) : lo {low} {}
+
+        friend constexpr auto operator<=> (const UInt128&, const UInt128&) = default;
+    };
+
+    /* Host order matching the kernels: floating NaNs go after every number, whatever their sign and payload,
+       so that sorting and merging on the host and the device agree on arrays with NaNs */
+    template <typename T>
+    struct SortLess
+    {
+        bool operator() (const T& lhs, const T& rhs) const {
+            if constexpr (std::is_floating_point_v<T> || std::is_same_v<T, Half>) {
+                bool lhsNan = std::isnan(static_cast<double>(lhs));
+                bool rhsNan = std::isnan(static_cast<double>(rhs));
+                return lhsNan || rhsNan ? rhsNan && !lhsNan : lhs < rhs;
+            }
+            else return lhs < rhs;
+        }
+    };
+
+    /* Decreasing order, NaNs go first */
+    template <typename T>
+    struct SortGreater
+    {
+        bool operator() (const T& lhs, const T& rhs) const { return SortLess<T> {}(rhs, lhs); }
+    };
+
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline cl_half Half::fromFloat(float value) {
+        uint32_t x = std::bit_cast<uint32_t>(value);
+        uint32_t sign = (x >> 16) & 0x8000;
+        uint32_t exponent = (x >> 23) & 0xff;
+        uint32_t mantissa = x & 0x7fffff;
+
+        /* Infinities stay infinite, NaNs stay quiet NaNs */
+        if (exponent == 0xff) return static_cast<cl_half>(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+
+        int biased = static_cast<int>(exponent) - 127 + 15;
+        if (biased >= 0x1f) return static_cast<cl_half>(sign | 0x7c00);
+        if (biased < -10) return static_cast<cl_half>(sign);
+
+        /* Round to nearest even, a carry out of the mantissa correctly bumps the exponent */
+        uint32_t shift = biased > 0 ? 13 : 14 - biased;
+        uint32_t half = biased > 0 ? (static_cast<uint32_t>(biased) << 10) | (mantissa >> 13) : (mantissa | 0x800000) >> shift;
+        uint32_t rest = (biased > 0 ? mantissa : mantissa | 0x800000) & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1))) ++half;
+        return static_cast<cl_half>(sign | half);
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline float Half::toFloat(cl_half bits) {
+        uint32_t sign = static_cast<uint32_t>(bits & 0x8000) << 16;
+        uint32_t exponent = (bits >> 10) & 0x1f;
+        uint32_t mantissa = bits & 0x3ff;
+
+        if (exponent == 0x1f) return std::bit_cast<float>(sign | 0x7f800000 | (mantissa << 13));
+        if (exponent == 0) return std::copysign(std::ldexp(static_cast<float>(mantissa), -24), sign ? -1.0f : 1.0f);
+        return std::bit_cast<float>(sign | ((exponent + 112) << 23) | (mantissa << 13));
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+};
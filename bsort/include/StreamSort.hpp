@@ -0,0 +1,323 @@
+#pragma once
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <future>
+#include <queue>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+#include "BitonicSorter.hpp"
+
+
+namespace OpenCLApp {
+
+    enum StreamFormat {
+        TEXT,
+        BINARY
+    };
+
+    /* Parses whitespace separated numbers from a file in large blocks with std::from_chars */
+    class TextReader final
+    {
+    private:
+        std::FILE*        file_;
+        std::vector<char> buffer_;
+        size_t            begin_ = 0;
+        size_t            end_ = 0;
+        bool              eof_ = false;
+
+    public:
+        TextReader(std::FILE* file, size_t blockSize = 1 << 24) : file_ {file}, buffer_(std::max<size_t>(blockSize, 64)) {}
+
+        /* Returns the number of values read, less than count only at the end of the file */
+        template <typename U>
+        size_t read(U* values, size_t count);
+
+    private:
+        bool refill();
+    };
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    /* Formats numbers with std::to_chars, one per line, and writes them in large blocks */
+    class TextWriter final
+    {
+    private:
+        std::FILE*        file_;
+        std::vector<char> buffer_;
+        size_t            used_ = 0;
+
+        /* Longest number std::to_chars produces, a double in scientific notation with all digits */
+        static constexpr size_t MAX_LENGTH = 64;
+
+    public:
+        TextWriter(std::FILE* file, size_t blockSize = 1 << 24) : file_ {file}, buffer_(std::max<size_t>(blockSize, MAX_LENGTH + 1)) {}
+        TextWriter(const TextWriter&) = delete;
+        ~TextWriter();
+
+        template <typename U>
+        void write(std::span<const U> values);
+        void flush();
+    };
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    /* Sorts a stream of text or binary values of unknown length, e.g. stdin of a shell pipeline.
+       The input is cut into runs, every run is sorted on the device while the next one is being parsed,
+       and a k-way merge writes the sorted runs out in large blocks. All runs stay in host memory,
+       binary files larger than that go through ExternalSorter. */
+    template <typename T>
+    class StreamSorter final
+    {
+    private:
+        BitonicSorter<T>& sorter_;
+        StreamFormat      format_;
+        size_t            runSize_;
+        size_t            blockSize_ = 1 << 20;
+
+    public:
+        /* The runs are merged on the host, so the sorter has to keep the natural order */
+        StreamSorter(BitonicSorter<T>& sorter, StreamFormat format = TEXT) :
+            sorter_ {sorter}, format_ {format}, runSize_ {std::min<size_t>(sorter.maxSortSize(), 1 << 24)} {
+            if (!sorter.comparator().empty()) throw std::runtime_error("Stream sorting needs the natural order");
+        }
+
+        /* Sorts at most count values of input into output */
+        void sort(std::FILE* input, std::FILE* output, SortDirection direction = INCREASING, size_t count = SIZE_MAX);
+
+        /* Reads the number of values first, as in "N, then N numbers" */
+        void sortCounted(std::FILE* input, std::FILE* output, SortDirection direction = INCREASING);
+
+        size_t runSize() const noexcept { return runSize_; }
+        void setRunSize(size_t size) { runSize_ = std::clamp<size_t>(size, 1, sorter_.maxSortSize()); }
+        void setBlockSize(size_t size) { blockSize_ = std::max<size_t>(size, 1); }
+
+    private:
+        template <typename U>
+        static size_t readBinary(std::FILE* input, U* values, size_t count);
+
+        /* Returns the number of values sorted */
+        template <typename Read>
+        size_t sortStream(Read&& read, std::FILE* output, SortDirection direction, size_t count);
+        template <typename Read>
+        std::vector<std::vector<T>> sortRuns(Read&& read, size_t count, SortDirection direction);
+        template <typename Write>
+        void mergeRuns(const std::vector<std::vector<T>>& runs, SortDirection direction, Write&& write);
+    };
+
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline bool TextReader::refill() {
+        /* The unparsed tail moves to the front, a number may continue in the next block */
+        std::copy(buffer_.begin() + begin_, buffer_.begin() + end_, buffer_.begin());
+        end_ -= begin_;
+        begin_ = 0;
+        if (end_ == buffer_.size()) buffer_.resize(2 * buffer_.size());
+
+        size_t read = std::fread(buffer_.data() + end_, 1, buffer_.size() - end_, file_);
+        if (read == 0) {
+            if (std::ferror(file_)) throw std::runtime_error("Can't read the input");
+            eof_ = true;
+        }
+        end_ += read;
+        return read != 0;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename U>
+    size_t TextReader::read(U* values, size_t count) {
+        auto isSpace = [](char c) { return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f'; };
+
+        size_t parsed = 0;
+        while (parsed < count) {
+            while (begin_ < end_ && isSpace(buffer_[begin_])) ++begin_;
+            if (begin_ == end_) {
+                if (eof_ || !refill()) break;
+                continue;
+            }
+
+            /* A number touching the end of the block is only whole at the end of the file */
+            size_t last = begin_;
+            while (last < end_ && !isSpace(buffer_[last])) ++last;
+            if (last == end_ && !eof_ && refill()) continue;
+
+            auto [ptr, error] = std::from_chars(buffer_.data() + begin_, buffer_.data() + last, values[parsed]);
+            if (error != std::errc {} || ptr != buffer_.data() + last)
+                throw std::runtime_error("Invalid number \"" + std::string {buffer_.data() + begin_, buffer_.data() + last} + "\"");
+            begin_ = last;
+            ++parsed;
+        }
+        return parsed;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline TextWriter::~TextWriter() {
+        /* Errors are reported by an explicit flush(), which leaves nothing to do here */
+        if (used_) std::fwrite(buffer_.data(), 1, used_, file_);
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename U>
+    void TextWriter::write(std::span<const U> values) {
+        for (auto& value: values) {
+            if (buffer_.size() - used_ <= MAX_LENGTH) flush();
+            auto [ptr, error] = std::to_chars(buffer_.data() + used_, buffer_.data() + buffer_.size() - 1, value);
+            if (error != std::errc {}) throw std::runtime_error("Can't format a number");
+            *ptr = '\n';
+            used_ = ptr + 1 - buffer_.data();
+        }
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline void TextWriter::flush() {
+        size_t size = std::exchange(used_, 0);
+        if (std::fwrite(buffer_.data(), 1, size, file_) != size) throw std::runtime_error("Can't write the output");
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    void StreamSorter<T>::sort(std::FILE* input, std::FILE* output, SortDirection direction, size_t count) {
+        if (format_ == TEXT) {
+            TextReader reader {input};
+            sortStream([&](T* values, size_t size) { return reader.read(values, size); }, output, direction, count);
+        }
+        else {
+            sortStream([&](T* values, size_t size) { return readBinary(input, values, size); }, output, direction, count);
+        }
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    void StreamSorter<T>::sortCounted(std::FILE* input, std::FILE* output, SortDirection direction) {
+        /* The count is read by the same reader, which keeps what it buffered past it */
+        size_t count = 0;
+        auto check = [&](size_t read) {
+            if (read != count) throw std::runtime_error("Expected " + std::to_string(count) + " elements, got " + std::to_string(read));
+        };
+
+        if (format_ == TEXT) {
+            TextReader reader {input};
+            if (reader.read(&count, 1) != 1) throw std::runtime_error("The input doesn't start with the number of elements");
+            check(sortStream([&](T* values, size_t size) { return reader.read(values, size); }, output, direction, count));
+        }
+        else {
+            if (readBinary(input, &count, 1) != 1) throw std::runtime_error("The input doesn't start with the number of elements");
+            check(sortStream([&](T* values, size_t size) { return readBinary(input, values, size); }, output, direction, count));
+        }
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    template <typename U>
+    size_t StreamSorter<T>::readBinary(std::FILE* input, U* values, size_t count) {
+        size_t read = std::fread(values, sizeof(U), count, input);
+        if (read < count && std::ferror(input)) throw std::runtime_error("Can't read the input");
+        return read;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    template <typename Read>
+    size_t StreamSorter<T>::sortStream(Read&& read, std::FILE* output, SortDirection direction, size_t count) {
+        auto runs = sortRuns(read, count, direction);
+
+        if (format_ == TEXT) {
+            TextWriter writer {output};
+            mergeRuns(runs, direction, [&](std::span<const T> values) { writer.write(values); });
+            writer.flush();
+        }
+        else {
+            mergeRuns(runs, direction, [&](std::span<const T> values) {
+                if (std::fwrite(values.data(), sizeof(T), values.size(), output) != values.size())
+                    throw std::runtime_error("Can't write the output");
+            });
+        }
+        if (std::fflush(output)) throw std::runtime_error("Can't write the output");
+
+        size_t total = 0;
+        for (auto& run: runs) total += run.size();
+        return total;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    template <typename Read>
+    std::vector<std::vector<T>> StreamSorter<T>::sortRuns(Read&& read, size_t count, SortDirection direction) {
+        std::vector<std::vector<T>> runs;
+        std::future<void> sorted;
+
+        while (count) {
+            /* Parse the next run while the device uploads and sorts the previous one */
+            std::vector<T> run(std::min(runSize_, count));
+            run.resize(read(run.data(), run.size()));
+            count -= run.size();
+            if (run.empty()) break;
+
+            if (sorted.valid()) sorted.get();
+            runs.push_back(std::move(run));
+            sorted = sorter_.sortAsync(runs.back(), direction);
+            if (runs.back().size() < runSize_) break;
+        }
+
+        if (sorted.valid()) sorted.get();
+        return runs;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    template <typename Write>
+    void StreamSorter<T>::mergeRuns(const std::vector<std::vector<T>>& runs, SortDirection direction, Write&& write) {
+        if (runs.size() == 1) {
+            for (size_t i = 0; i < runs[0].size(); i += blockSize_)
+                write(std::span<const T> {runs[0]}.subspan(i, std::min(blockSize_, runs[0].size() - i)));
+            return;
+        }
+
+        /* The heap top is the run whose head goes first, ties keep the run order */
+        std::vector<size_t> positions(runs.size());
+        SortLess<T> less;
+        auto later = [&](size_t lhs, size_t rhs) {
+            const T& a = runs[lhs][positions[lhs]];
+            const T& b = runs[rhs][positions[rhs]];
+            if (direction == INCREASING ? less(b, a) : less(a, b)) return true;
+            if (direction == INCREASING ? less(a, b) : less(b, a)) return false;
+            return lhs > rhs;
+        };
+        std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heads {later};
+        for (size_t i = 0; i < runs.size(); ++i)
+            if (!runs[i].empty()) heads.push(i);
+
+        std::vector<T> block;
+        block.reserve(blockSize_);
+        while (!heads.empty()) {
+            size_t run = heads.top();
+            heads.pop();
+
+            block.push_back(runs[run][positions[run]]);
+            if (++positions[run] < runs[run].size()) heads.push(run);
+            if (block.size() == blockSize_) {
+                write(std::span<const T> {block});
+                block.clear();
+            }
+        }
+        if (!block.empty()) write(std::span<const T> {block});
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+};
@@ -0,0 +1,176 @@
+#pragma once
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include "ProgramCache.hpp"
+
+
+namespace OpenCLApp {
+
+    /* Persistent per-device tuning results, e.g. the host/device crossover size.
+       Values are kept in one text file next to the cached program binaries, one "key<TAB>value" per line,
+       and are read once per process and cache directory. A store merges the file again under a lock file, so concurrent processes
+       don't drop each other's entries. With the program cache disabled results live in memory only. */
+    class TuningCache final
+    {
+    public:
+        static std::optional<size_t> load(const std::string& key);
+        static void store(const std::string& key, size_t value);
+
+        static std::string deviceKey(const cl::Device& device);
+
+    private:
+        static std::filesystem::path file();
+        static std::map<std::string, size_t>& entries();
+        static std::map<std::string, size_t> read(const std::filesystem::path& path);
+        static std::mutex& mutex();
+
+        /* Lock file held while the table is rewritten */
+        class FileLock;
+    };
+
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline std::filesystem::path TuningCache::file() {
+        auto directory = ProgramCache::directory();
+        return directory.empty() ? directory : directory / "tuning.txt";
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline std::mutex& TuningCache::mutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    class TuningCache::FileLock final
+    {
+    private:
+        std::filesystem::path path_;
+        bool                  locked_ = false;
+
+    public:
+        /* A rewrite takes milliseconds, so an older lock file was left behind by a crashed process */
+        static constexpr std::chrono::seconds STALE {10};
+
+        /* Waits a while for the lock and removes a stale lock file on the way. A live holder past the wait is ignored */
+        FileLock(std::filesystem::path path) : path_ {std::move(path)} {
+            for (int attempt = 0; attempt < 100 && !locked_; ++attempt) {
+                if (auto file = std::fopen(path_.string().c_str(), "wx")) {
+                    std::fclose(file);
+                    locked_ = true;
+                }
+                else if (stale()) {
+                    std::error_code error;
+                    std::filesystem::remove(path_, error);
+                }
+                else std::this_thread::sleep_for(std::chrono::milliseconds {10});
+            }
+        }
+        FileLock(const FileLock&) = delete;
+        FileLock& operator= (const FileLock&) = delete;
+        ~FileLock() {
+            std::error_code error;
+            if (locked_) std::filesystem::remove(path_, error);
+        }
+
+    private:
+        bool stale() const {
+            std::error_code error;
+            auto written = std::filesystem::last_write_time(path_, error);
+            return !error && std::filesystem::file_time_type::clock::now() - written > STALE;
+        }
+    };
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline std::map<std::string, size_t> TuningCache::read(const std::filesystem::path& path) {
+        std::map<std::string, size_t> entries;
+        std::ifstream input {path};
+        std::string line;
+        while (std::getline(input, line)) {
+            auto tab = line.rfind('\t');
+            if (tab == line.npos) continue;
+            try {
+                entries[line.substr(0, tab)] = std::stoull(line.substr(tab + 1));
+            }
+            catch (std::exception&) {}
+        }
+        return entries;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline std::map<std::string, size_t>& TuningCache::entries() {
+        /* Expects mutex() to be held. One table per file, so a new cache directory reads its own */
+        static std::map<std::filesystem::path, std::map<std::string, size_t>> tables;
+        auto path = file();
+        auto [table, inserted] = tables.try_emplace(path);
+        if (inserted && !path.empty()) table->second = read(path);
+        return table->second;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline std::optional<size_t> TuningCache::load(const std::string& key) {
+        std::lock_guard lock {mutex()};
+        auto& values = entries();
+        auto it = values.find(key);
+        if (it == values.end()) return std::nullopt;
+        return it->second;
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline void TuningCache::store(const std::string& key, size_t value) {
+        std::lock_guard lock {mutex()};
+        auto& values = entries();
+        values[key] = value;
+
+        auto path = file();
+        if (path.empty()) return;
+
+        std::error_code error;
+        std::filesystem::create_directories(path.parent_path(), error);
+        if (error) return;
+
+        /* Entries other processes stored since the file was read are merged in, ours wins on its own key */
+        auto lockPath = path;
+        lockPath += ".lock";
+        FileLock fileLock {lockPath};
+        auto merged = read(path);
+        merged[key] = value;
+        for (auto& [name, number]: merged) values[name] = number;
+
+        /* Rewrite the whole file through a temporary one so readers never see a partial table */
+        auto temp = ProgramCache::createTemp(path);
+        if (temp.empty()) return;
+        std::ofstream output {temp};
+        for (auto& [name, number]: merged) output << name << '\t' << number << '\n';
+        output.close();
+        if (!output) {
+            std::filesystem::remove(temp, error);
+            return;
+        }
+        std::filesystem::rename(temp, path, error);
+        if (error) std::filesystem::remove(temp, error);
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+    inline std::string TuningCache::deviceKey(const cl::Device& device) {
+        return device.getInfo<CL_DEVICE_NAME>() + '|' + device.getInfo<CL_DRIVER_VERSION>();
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------
+
+};
@@ -1,2 +0,0 @@
-#pragma once
-#define CL_PROGRAM_PATH "/home/amadey/Документы/Projects/OpenCL/bsort/src/bsort.cl"
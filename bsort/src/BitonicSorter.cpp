@@ -1,24 +1,29 @@
 #include "BitonicSorter.hpp"
+#include "ExternalSort.hpp"
+#include "StreamSort.hpp"
 #include <algorithm>
 #include <boost/program_options.hpp>
 #include <boost/program_options/options_description.hpp>
 #include <boost/program_options/value_semantic.hpp>
 #include <chrono>
 #include <cstddef>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <exception>
+#include <fstream>
+#include <memory>
 #include <iostream>
 #include <ostream>
 #include <random>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 #ifndef TYPE
 #define TYPE int
 #endif
 
-using T = int;
-
 #ifndef PLATFORM
 #define PLATFORM NVIDIA
 #endif
@@ -30,14 +35,30 @@ namespace chr = std::chrono;
 
 auto ParseConsoleArgument(int ac, const char** av) {
   std::string platform;
+  std::string cacheDir;
+  std::string input;
+  std::string output;
+  std::string trace;
+  std::string format;
+  std::string type;
   std::size_t size = 0;
   bool isTestMode = true;
+  bool isCounted = false;
+  bool isTuning = false;
 
   po::options_description desc("Allowed options");
   desc.add_options()
       ("help", "produce help message")
       ("platform", po::value<std::string>(&platform)->default_value("NVIDIA"), "platform for computing. By defaul NVIDIA")
       ("test", po::value<std::size_t>(&size), "the amount of elements to generate N random numbers")
+      ("cache-dir", po::value<std::string>(&cacheDir), "directory for built program binaries. Empty disables the cache")
+      ("input", po::value<std::string>(&input), "file to sort instead of stdin. A binary one given with --output may be larger than device memory")
+      ("output", po::value<std::string>(&output), "file for the sorted elements instead of stdout")
+      ("format", po::value<std::string>(&format)->default_value("text"), "text (whitespace separated numbers) or binary (raw elements)")
+      ("type", po::value<std::string>(&type)->default_value("int"), "element type: int, unsigned, int64, uint64, int16, uint16, int8, uint8, float or double")
+      ("counted", po::bool_switch(&isCounted), "the input starts with the number of elements")
+      ("trace", po::value<std::string>(&trace), "Chrome trace file of the device commands of --test, prints time per stage")
+      ("tune", po::bool_switch(&isTuning), "measure the work-group size, fusion depth and host/device crossover of the device and store them")
   ;
 
   po::variables_map vm;
@@ -48,40 +69,60 @@ auto ParseConsoleArgument(int ac, const char** av) {
     std::cout << desc << "\n";
     std::exit(0);
   }
+  if (vm.count("cache-dir")) {
+    OpenCLApp::ProgramCache::setDirectory(cacheDir);
+  }
+  if (format != "text" && format != "binary") {
+    throw std::runtime_error("--format must be text or binary");
+  }
   if (vm.count("test")) {
     std::cout << "Number of random elements for test " << size << ".\n";
   } else {
     isTestMode = false;
-    std::cin >> size;
   }
-  return std::make_tuple(platform, size, isTestMode);
+  auto streamFormat = format == "binary" ? OpenCLApp::BINARY : OpenCLApp::TEXT;
+  return std::make_tuple(platform, size, isTestMode, input, output, trace, streamFormat, isCounted, isTuning, type);
 }
 
-auto fillData(std::size_t size, bool isTestMode) {
-  std::vector<T> data(size);
-  if (isTestMode) {
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> rand(-1000, 1000);
-    for (size_t i = 0; i < size; ++i) {
-      data[i] = rand(gen);
-    }
-  } else {
-    for (size_t i = 0; i < size; ++i) {
-      std::cin >> data[i];
-    }
+template <typename Run>
+void DispatchType(const std::string& type, Run&& run) {
+  /* The sorters are templates, every type the command line takes is instantiated here */
+  if      (type == "int")      run(std::type_identity<int> {});
+  else if (type == "unsigned") run(std::type_identity<unsigned> {});
+  else if (type == "int64")    run(std::type_identity<int64_t> {});
+  else if (type == "uint64")   run(std::type_identity<uint64_t> {});
+  else if (type == "int16")    run(std::type_identity<int16_t> {});
+  else if (type == "uint16")   run(std::type_identity<uint16_t> {});
+  else if (type == "int8")     run(std::type_identity<int8_t> {});
+  else if (type == "uint8")    run(std::type_identity<uint8_t> {});
+  else if (type == "float")    run(std::type_identity<float> {});
+  else if (type == "double")   run(std::type_identity<double> {});
+  else throw std::runtime_error("Unsupported --type " + type);
+}
+
+void PrintProfile(const OpenCLApp::SortProfile& profile, const std::string& trace) {
+  std::cout << "Device time per stage:\n";
+  for (auto& stage : profile.stats()) {
+    std::cout << "  " << stage.stage;
+    if (stage.stride) std::cout << " stride " << stage.stride;
+    std::cout << ": " << stage.launches << " launches, "
+              << chr::duration_cast<chr::duration<float, std::milli>>(stage.total).count() << " ms\n";
   }
-  return data;
+
+  std::ofstream output(trace);
+  profile.writeChromeTrace(output);
+  if (!output) throw std::runtime_error("Can't write " + trace);
 }
 
-void RunTestProgram(std::string platformName, std::size_t size) {
+template <typename T>
+void RunTestProgram(std::string platformName, std::size_t size, const std::string& trace) {
   std::vector<T> data(size);
 
   std::random_device rd;
   std::mt19937 gen(rd());
   std::uniform_int_distribution<> rand(-1000, 1000);
 
-  for (auto&& x : data) x = rand(gen);
+  for (auto&& x : data) x = static_cast<T>(rand(gen));
   std::vector dataCopy = data;
 
   auto start = chr::high_resolution_clock::now();
@@ -92,38 +133,81 @@ void RunTestProgram(std::string platformName, std::size_t size) {
             << " sec." << std::endl;
 
   OpenCLApp::BitonicSorter<T> sort(platformName);
+  if (!trace.empty()) sort.setProfiling(true);
   start = chr::high_resolution_clock::now();
   sort(data.begin(), data.end());
   end   = chr::high_resolution_clock::now();
   std::cout << "My bsort() time: "
             << std::chrono::duration_cast<chr::duration<float>>(end - start).count()
             << " sec." << std::endl;
+
+  if (!trace.empty()) PrintProfile(sort.profile(), trace);
 }
 
-int main(int ac, const char **av) try {
-  auto [platform, size, isTestMode] = ParseConsoleArgument(ac, av);
+template <typename T>
+void RunTuning(std::string platformName) {
+  /* Later sorters of the device load the profile at construction, the crossover through calibrate() */
+  OpenCLApp::BitonicSorter<T> sort(platformName);
+  sort.tune();
+  auto crossover = sort.calibrate(true);
+  std::cout << "Work-group size " << sort.maxLocalSize() << ", fused steps " << sort.fusedSteps()
+            << ", host/device crossover " << crossover << " elements." << std::endl;
+}
 
-  if (isTestMode) {
-    RunTestProgram(platform, size);
-  }
-//  } else {
-//    RunGeneralProgram();
-//  }
-//
-//  auto&& data = fillData(size, isTestMode);
-//
-//  OpenCLApp::BitonicSorter<T> sort(platform);
-//  sort(data.begin(), data.end());
-//
-//  for (auto &x : data) {
-//    std::cout << x << ' ';
-//  }
-//  std::cout << std::endl;
+template <typename T>
+void RunFileSort(std::string platformName, const std::string& input, const std::string& output) {
+  OpenCLApp::BitonicSorter<T> sort(platformName);
+  OpenCLApp::ExternalSorter<T> external(sort);
+
+  auto start = chr::high_resolution_clock::now();
+  external.sortFile(input, output);
+  auto end   = chr::high_resolution_clock::now();
+  std::cout << "Sorted " << input << " into " << output << " in "
+            << std::chrono::duration_cast<chr::duration<float>>(end - start).count()
+            << " sec." << std::endl;
+}
+
+template <typename T>
+void RunStreamSort(std::string platformName, const std::string& input, const std::string& output,
+                   OpenCLApp::StreamFormat format, bool isCounted) {
+  /* Standard streams are used when no file is given, so bsort works in shell pipelines */
+  auto open = [](const std::string& path, const char* mode, std::FILE* standard) {
+    auto close = [](std::FILE* file) { if (file != stdin && file != stdout) std::fclose(file); };
+    std::unique_ptr<std::FILE, decltype(close)> file {path.empty() ? standard : std::fopen(path.c_str(), mode), close};
+    if (!file) throw std::runtime_error("Can't open " + path);
+    return file;
+  };
+  auto inputFile = open(input, "rb", stdin);
+  auto outputFile = open(output, "wb", stdout);
+
+  OpenCLApp::BitonicSorter<T> sort(platformName);
+  OpenCLApp::StreamSorter<T> stream(sort, format);
+  if (isCounted) stream.sortCounted(inputFile.get(), outputFile.get());
+  else stream.sort(inputFile.get(), outputFile.get());
+}
+
+int main(int ac, const char **av) try {
+  auto [platform, size, isTestMode, input, output, trace, format, isCounted, isTuning, type] = ParseConsoleArgument(ac, av);
+
+  DispatchType(type, [&]<typename T>(std::type_identity<T>) {
+    if (isTuning) {
+      RunTuning<T>(platform);
+    } else if (isTestMode) {
+      RunTestProgram<T>(platform, size, trace);
+    } else if (format == OpenCLApp::BINARY && !isCounted && !input.empty() && !output.empty()) {
+      RunFileSort<T>(platform, input, output);
+    } else {
+      RunStreamSort<T>(platform, input, output, format, isCounted);
+    }
+  });
 }
 
+/* Errors go to stderr, stdout may be the sorted data */
 catch (cl::Error &error) {
-  std::cout << error.what() << ". Error code = " << error.err() << '\n';
+  std::cerr << error.what() << ". Error code = " << error.err() << '\n';
+  return EXIT_FAILURE;
 } catch (std::exception &error) {
-  std::cout << error.what() << "\n";
+  std::cerr << error.what() << "\n";
+  return EXIT_FAILURE;
 }
 
@@ -1,150 +1,476 @@
+
 #pragma OPENCL EXTENSION cl_khr_fp64 : enable
+#ifdef cl_khr_fp16
+#pragma OPENCL EXTENSION cl_khr_fp16 : enable
+#endif
 
 /* Template parameters for the sorting of a given type of array */
 // #define TYPE double4
+// #define SCALAR_TYPE double
 // #define COMPORATOR_TYPE long4
 // #define MASK_TYPE ulong4
-// #define TYPE_CAST as_ulong4
+// #define TYPE_MAX INFINITY
+// #define TYPE_MIN -INFINITY
+// #define VECTOR_WIDTH 4
+// #define KEY_FLOAT
+
+/* Parameters of the values sorted along with the keys */
+// #define VALUE_TYPE uint
+// #define VALUE_CAST convert_int4
+// #define VALUE_MAX UINT_MAX
+// #define VALUE_MIN 0
+// #define LEXICOGRAPHIC
+
+#define CAT(a, b) a ## b
+#define XCAT(a, b) CAT(a, b)
+
+#ifndef VECTOR_WIDTH
+#define VECTOR_WIDTH 4
+#endif
+
+/* Values are 32-bit by default, the key comparison masks are converted to their lane size to move them */
+#ifndef VALUE_TYPE
+#define VALUE_TYPE uint
+#define VALUE_MAX UINT_MAX
+#define VALUE_MIN 0
+#endif
+#ifndef VALUE_CAST
+#define VALUE_CAST XCAT(convert_int, VECTOR_WIDTH)
+#endif
+
+#define VALUE_VECTOR XCAT(VALUE_TYPE, VECTOR_WIDTH)
+
+/* Value comparison masks converted back to the lane size of the keys */
+#define KEY_CAST XCAT(convert_, COMPORATOR_TYPE)
+#define VLOAD XCAT(vload, VECTOR_WIDTH)
+#define VSTORE XCAT(vstore, VECTOR_WIDTH)
 
 //------------------------------------------------------------------------------------------------------------------------------
 
 #define UP 0
 #define DOWN -1
 
-#define mask_1 (MASK_TYPE)(1, 0, 3, 2)
-#define mask_2 (MASK_TYPE)(2, 3, 0, 1)
-#define mask_3 (MASK_TYPE)(3, 2, 1, 0)
-
-#define add_mask_1 (COMPORATOR_TYPE)(1, 1, 3, 3)
-#define add_mask_2 (COMPORATOR_TYPE)(2, 3, 2, 3)
-#define add_mask_3 (COMPORATOR_TYPE)(1, 2, 2, 3)
-#define add_mask_4 (COMPORATOR_TYPE)(4, 5, 6, 7)
+/* Partner lanes (lane ^ d) and the upper lane of every pair (lane & d), one table per vector width */
+#if VECTOR_WIDTH == 4
+#define LANES_XOR_1 1, 0, 3, 2
+#define LANES_XOR_2 2, 3, 0, 1
+#define LANES_XOR_3 3, 2, 1, 0
+#define LANES_REVERSE LANES_XOR_3
+#define UPPER_LANES_1 0, -1, 0, -1
+#define UPPER_LANES_2 0, 0, -1, -1
+#elif VECTOR_WIDTH == 8
+#define LANES_XOR_1 1, 0, 3, 2, 5, 4, 7, 6
+#define LANES_XOR_2 2, 3, 0, 1, 6, 7, 4, 5
+#define LANES_XOR_3 3, 2, 1, 0, 7, 6, 5, 4
+#define LANES_XOR_4 4, 5, 6, 7, 0, 1, 2, 3
+#define LANES_XOR_7 7, 6, 5, 4, 3, 2, 1, 0
+#define LANES_REVERSE LANES_XOR_7
+#define UPPER_LANES_1 0, -1, 0, -1, 0, -1, 0, -1
+#define UPPER_LANES_2 0, 0, -1, -1, 0, 0, -1, -1
+#define UPPER_LANES_4 0, 0, 0, 0, -1, -1, -1, -1
+#elif VECTOR_WIDTH == 16
+#define LANES_XOR_1 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14
+#define LANES_XOR_2 2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13
+#define LANES_XOR_3 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+#define LANES_XOR_4 4, 5, 6, 7, 0, 1, 2, 3, 12, 13, 14, 15, 8, 9, 10, 11
+#define LANES_XOR_7 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8
+#define LANES_XOR_8 8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7
+#define LANES_XOR_15 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0
+#define LANES_REVERSE LANES_XOR_15
+#define UPPER_LANES_1 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1
+#define UPPER_LANES_2 0, 0, -1, -1, 0, 0, -1, -1, 0, 0, -1, -1, 0, 0, -1, -1
+#define UPPER_LANES_4 0, 0, 0, 0, -1, -1, -1, -1, 0, 0, 0, 0, -1, -1, -1, -1
+#define UPPER_LANES_8 0, 0, 0, 0, 0, 0, 0, 0, -1, -1, -1, -1, -1, -1, -1, -1
+#else
+#error "VECTOR_WIDTH must be 4, 8 or 16"
+#endif
 
 //------------------------------------------------------------------------------------------------------------------------------
 
-/* Sort elements in a vector */
-#define SORT_VECTOR(input, dir)                                    \
-   comp = (input < shuffle(input, mask_1)) ^ dir;                  \
-   input = shuffle(input, TYPE_CAST(comp     + add_mask_1));       \
-   comp = (input < shuffle(input, mask_2)) ^ dir;                  \
-   input = shuffle(input, TYPE_CAST(comp * 2 + add_mask_2));       \
-   comp = (input < shuffle(input, mask_3)) ^ dir;                  \
-   input = shuffle(input, TYPE_CAST(comp     + add_mask_3));       \
+/*
+ * A custom order is spliced in ahead of this file, see BitonicSorter's comparator. It defines LESS(a, b),
+ * or KEY(x) to compare keys extracted from the elements, for scalars and vectors alike, and ORDER_MAX and ORDER_MIN,
+ * the elements that go after and before every other one, which pad the arrays. Elements with the same key
+ * as the padding may come back as the padding.
+ */
+#if (defined(LESS) || defined(KEY)) && !(defined(ORDER_MAX) && defined(ORDER_MIN))
+#error "A custom order has to define ORDER_MAX and ORDER_MIN"
+#endif
+
+#ifndef KEY
+#define KEY(input) (input)
+#endif
+
+#ifndef LESS
+#ifdef KEY_FLOAT
+/* NaNs go after every number, so that floats are totally ordered */
+#define LESS(input1, input2) ((KEY(input1) < KEY(input2)) | (isnan(KEY(input2)) & !isnan(KEY(input1))))
+#else
+#define LESS(input1, input2) (KEY(input1) < KEY(input2))
+#endif
+#endif
+
+/* Strict order of keys in the sort direction, so that equal keys never trade places */
+#define BEFORE(input1, input2, dir) ((dir) == UP ? LESS(input1, input2) : LESS(input2, input1))
+
+/* Order of values, which are plain unsigned integers */
+#define VALUE_BEFORE(input1, input2, dir) ((dir) == UP ? (input1) < (input2) : (input2) < (input1))
+
+/* Order of key-value pairs, lexicographic pairs break key ties by the value */
+#ifdef LEXICOGRAPHIC
+#define BEFORE_KV(key1, value1, key2, value2, dir) \
+   (BEFORE(key1, key2, dir) | (!LESS(key1, key2) & !LESS(key2, key1) & KEY_CAST(VALUE_BEFORE(value1, value2, dir))))
+#else
+#define BEFORE_KV(key1, value1, key2, value2, dir) BEFORE(key1, key2, dir)
+#endif
+
+/* Compare-exchange every lane with its partner lane, the lower lane of a pair gets the element that goes first */
+#define EXCHANGE_VECTOR(input, partners, upper, dir)                                                          \
+   temp = shuffle(input, (MASK_TYPE)(partners));                                                             \
+   comp = BEFORE(select(temp, input, (COMPORATOR_TYPE)(upper)), select(input, temp, (COMPORATOR_TYPE)(upper)), dir); \
+   input = select(input, temp, comp);                                                                        \
+
+/* The same for a key vector, carrying the values along */
+#define EXCHANGE_VECTOR_KV(key, value, partners, upper, dir)                                                  \
+   temp = shuffle(key, (MASK_TYPE)(partners));                                                               \
+   value_temp = shuffle(value, (VALUE_VECTOR)(partners));                                                    \
+   comp = BEFORE_KV(select(temp, key, (COMPORATOR_TYPE)(upper)),                                             \
+                    select(value_temp, value, VALUE_CAST((COMPORATOR_TYPE)(upper))),                         \
+                    select(key, temp, (COMPORATOR_TYPE)(upper)),                                             \
+                    select(value, value_temp, VALUE_CAST((COMPORATOR_TYPE)(upper))), dir);                   \
+   key = select(key, temp, comp);                                                                            \
+   value = select(value, value_temp, VALUE_CAST(comp));                                                      \
+
+/* Sort elements in a vector: every run of 2, 4, ... lanes is flipped against its neighbour, then half-cleaned */
+#define SORT_VECTOR_4(input, dir)                                         \
+   EXCHANGE_VECTOR(input, LANES_XOR_1, UPPER_LANES_1, dir)               \
+   EXCHANGE_VECTOR(input, LANES_XOR_3, UPPER_LANES_2, dir)               \
+   EXCHANGE_VECTOR(input, LANES_XOR_1, UPPER_LANES_1, dir)               \
+
+#define SORT_VECTOR_8(input, dir)                                         \
+   SORT_VECTOR_4(input, dir)                                             \
+   EXCHANGE_VECTOR(input, LANES_XOR_7, UPPER_LANES_4, dir)               \
+   MERGE_VECTOR_4(input, dir)                                            \
+
+#define SORT_VECTOR_16(input, dir)                                        \
+   SORT_VECTOR_8(input, dir)                                             \
+   EXCHANGE_VECTOR(input, LANES_XOR_15, UPPER_LANES_8, dir)              \
+   MERGE_VECTOR_8(input, dir)                                            \
+
+/* Finish the merge of a vector once the steps across vectors are done */
+#define MERGE_VECTOR_4(input, dir)                                        \
+   EXCHANGE_VECTOR(input, LANES_XOR_2, UPPER_LANES_2, dir)               \
+   EXCHANGE_VECTOR(input, LANES_XOR_1, UPPER_LANES_1, dir)               \
+
+#define MERGE_VECTOR_8(input, dir)                                        \
+   EXCHANGE_VECTOR(input, LANES_XOR_4, UPPER_LANES_4, dir)               \
+   MERGE_VECTOR_4(input, dir)                                            \
+
+#define MERGE_VECTOR_16(input, dir)                                       \
+   EXCHANGE_VECTOR(input, LANES_XOR_8, UPPER_LANES_8, dir)               \
+   MERGE_VECTOR_8(input, dir)                                            \
+
+#define SORT_VECTOR_KV_4(key, value, dir)                                 \
+   EXCHANGE_VECTOR_KV(key, value, LANES_XOR_1, UPPER_LANES_1, dir)       \
+   EXCHANGE_VECTOR_KV(key, value, LANES_XOR_3, UPPER_LANES_2, dir)       \
+   EXCHANGE_VECTOR_KV(key, value, LANES_XOR_1, UPPER_LANES_1, dir)       \
+
+#define SORT_VECTOR_KV_8(key, value, dir)                                 \
+   SORT_VECTOR_KV_4(key, value, dir)                                     \
+   EXCHANGE_VECTOR_KV(key, value, LANES_XOR_7, UPPER_LANES_4, dir)       \
+   MERGE_VECTOR_KV_4(key, value, dir)                                    \
+
+#define SORT_VECTOR_KV_16(key, value, dir)                                \
+   SORT_VECTOR_KV_8(key, value, dir)                                     \
+   EXCHANGE_VECTOR_KV(key, value, LANES_XOR_15, UPPER_LANES_8, dir)      \
+   MERGE_VECTOR_KV_8(key, value, dir)                                    \
+
+#define MERGE_VECTOR_KV_4(key, value, dir)                                \
+   EXCHANGE_VECTOR_KV(key, value, LANES_XOR_2, UPPER_LANES_2, dir)       \
+   EXCHANGE_VECTOR_KV(key, value, LANES_XOR_1, UPPER_LANES_1, dir)       \
+
+#define MERGE_VECTOR_KV_8(key, value, dir)                                \
+   EXCHANGE_VECTOR_KV(key, value, LANES_XOR_4, UPPER_LANES_4, dir)       \
+   MERGE_VECTOR_KV_4(key, value, dir)                                    \
+
+#define MERGE_VECTOR_KV_16(key, value, dir)                               \
+   EXCHANGE_VECTOR_KV(key, value, LANES_XOR_8, UPPER_LANES_8, dir)       \
+   MERGE_VECTOR_KV_8(key, value, dir)                                    \
+
+#define SORT_VECTOR(input, dir)              XCAT(SORT_VECTOR_, VECTOR_WIDTH)(input, dir)
+#define MERGE_VECTOR(input, dir)             XCAT(MERGE_VECTOR_, VECTOR_WIDTH)(input, dir)
+#define SORT_VECTOR_KV(key, value, dir)      XCAT(SORT_VECTOR_KV_, VECTOR_WIDTH)(key, value, dir)
+#define MERGE_VECTOR_KV(key, value, dir)     XCAT(MERGE_VECTOR_KV_, VECTOR_WIDTH)(key, value, dir)
 
 /* Sort elements between two vectors */
-#define SWAP_VECTORS(input1, input2, dir)                         \
-   temp = input1;                                                 \
-   comp = ((input1 < input2) ^ dir) * 4 + add_mask_4;             \
-   input1 = shuffle2(input1, input2, TYPE_CAST(comp));            \
-   input2 = shuffle2(input2, temp,   TYPE_CAST(comp));            \
+#define SWAP_VECTORS(input1, input2, dir)                                       \
+   comp = BEFORE(input2, input1, dir);                                          \
+   temp = input1;                                                               \
+   input1 = select(input1, input2, comp);                                       \
+   input2 = select(input2, temp, comp);                                         \
+
+/* Sort elements between two key vectors together with their values */
+#define SWAP_VECTORS_KV(key1, value1, key2, value2, dir)                        \
+   comp = BEFORE_KV(key2, value2, key1, value1, dir);                           \
+   temp = key1;                                                                 \
+   key1 = select(key1, key2, comp);                                             \
+   key2 = select(key2, temp, comp);                                             \
+   value_temp = value1;                                                         \
+   value1 = select(value1, value2, VALUE_CAST(comp));                           \
+   value2 = select(value2, value_temp, VALUE_CAST(comp));                       \
+
+/* Reverse the order of elements in a vector */
+#define REVERSE_VECTOR(input)                                                   \
+   input = shuffle(input, (MASK_TYPE)(LANES_REVERSE));                          \
+
+#define REVERSE_VALUES(value)                                                   \
+   value = shuffle(value, (VALUE_VECTOR)(LANES_REVERSE));                       \
+
+/* Narrow the kernel down to the segment given by the second NDRange dimension, a single array has no offsets */
+#define SELECT_SEGMENT(g_data, offsets, size)                                   \
+   if (offsets) {                                                               \
+      g_data += offsets[get_global_id(1)];                                      \
+      size = offsets[get_global_id(1) + 1] - offsets[get_global_id(1)];         \
+   }                                                                            \
+
+/* Elements past the end of the array act as the largest values in the sort direction */
+#ifdef ORDER_MAX
+#define PADDING(dir) ((dir) == UP ? (SCALAR_TYPE)(ORDER_MAX) : (SCALAR_TYPE)(ORDER_MIN))
+#else
+#define PADDING(dir) ((dir) == UP ? (SCALAR_TYPE)(TYPE_MAX) : (SCALAR_TYPE)(TYPE_MIN))
+#endif
+#define VALUE_PADDING(dir) ((dir) == UP ? (VALUE_TYPE)(VALUE_MAX) : (VALUE_TYPE)(VALUE_MIN))
+
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+/* Load a vector, substituting padding for the elements past the end of the array */
+TYPE load_vector(__global const SCALAR_TYPE *g_data, uint index, uint size, int dir) {
+
+   uint first = index * VECTOR_WIDTH;
+   if (first + VECTOR_WIDTH <= size)
+      return VLOAD(index, g_data);
+
+   SCALAR_TYPE tail[VECTOR_WIDTH];
+   for (uint i = 0; i < VECTOR_WIDTH; ++i)
+      tail[i] = (first + i < size) ? g_data[first + i] : PADDING(dir);
+   return VLOAD(0, tail);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+/* Store a vector, dropping the elements past the end of the array */
+void store_vector(TYPE input, __global SCALAR_TYPE *g_data, uint index, uint size) {
+
+   uint first = index * VECTOR_WIDTH;
+   if (first + VECTOR_WIDTH <= size) {
+      VSTORE(input, index, g_data);
+      return;
+   }
+
+   SCALAR_TYPE tail[VECTOR_WIDTH];
+   VSTORE(input, 0, tail);
+   for (uint i = 0; i < VECTOR_WIDTH && first + i < size; ++i)
+      g_data[first + i] = tail[i];
+}
 
 
 //------------------------------------------------------------------------------------------------------------------------------
 
+/*
+ * The network below only ever moves the smaller element (in the sort direction) to the lower index.
+ * Padding past the end of the array is the largest value, so it never moves and is never stored:
+ * every array is sorted as if it were padded up to a power of two, without the padding existing.
+ * Runs are merged by comparing each element with its mirror in the next run, then with half-cleaners.
+ */
 
-/* Perform initial sort */
-__kernel void bsort_init(__global TYPE *g_data, __local TYPE *l_data) {
+/* Perform initial sort of a tile of 2 * VECTOR_WIDTH * local_size elements */
+__kernel void bsort_init(__global SCALAR_TYPE *g_data, __global const uint *offsets, __local TYPE *l_data, uint size, int dir) {
 
    TYPE temp;
    COMPORATOR_TYPE comp;
 
-   uint id = get_local_id(0) * 2;
-   uint global_start = get_group_id(0) * get_local_size(0) * 2 + id;
-
-   TYPE input1 = g_data[global_start]; 
-   TYPE input2 = g_data[global_start + 1];
+   /* Work-groups past the end of a short segment have nothing to sort */
+   SELECT_SEGMENT(g_data, offsets, size);
+   if (get_group_id(0) * get_local_size(0) * 2 * VECTOR_WIDTH >= size) return;
 
-   /* Sort input 1 - ascending, input 2 - descending */
-   SORT_VECTOR(input1, UP);
-   SORT_VECTOR(input2, DOWN);    
+   uint lid = get_local_id(0);
+   uint id = lid * 2;
+   uint global_start = get_group_id(0) * get_local_size(0) * 2 + id;
 
-   /* Swap corresponding elements of input 1 and 2 */
-   int dir = (get_local_id(0) % 2) * -1;
-   SWAP_VECTORS(input1, input2, dir); 
+   TYPE input1 = load_vector(g_data, global_start, size, dir);
+   TYPE input2 = load_vector(g_data, global_start + 1, size, dir);
 
-   /* Sort data and store in local memory */
+   /* Sort the 2 * VECTOR_WIDTH elements held by the work-item */
    SORT_VECTOR(input1, dir);
    SORT_VECTOR(input2, dir);
+   REVERSE_VECTOR(input2);
+   SWAP_VECTORS(input1, input2, dir);
+   MERGE_VECTOR(input1, dir);
+   MERGE_VECTOR(input2, dir);
    l_data[id] = input1;
    l_data[id + 1] = input2;
 
-   /* Create bitonic set */
-   for(uint size = 2; size < get_local_size(0); size <<= 1) {
-      dir = (get_local_id(0)/size & 1) * -1;
+   /* Merge runs of `half` vectors until the whole tile is sorted */
+   for(uint half = 2; half <= get_local_size(0); half <<= 1) {
+      barrier(CLK_LOCAL_MEM_FENCE);
+      uint offset = lid % half;
+      id = (lid / half) * half * 2 + offset;
+      uint mirror = id - offset * 2 + half * 2 - 1;
+
+      input1 = l_data[id]; input2 = l_data[mirror];
+      REVERSE_VECTOR(input2);
+      SWAP_VECTORS(input1, input2, dir);
+      REVERSE_VECTOR(input2);
+      l_data[id] = input1;
+      l_data[mirror] = input2;
 
-      for(uint stride = size; stride > 1; stride >>= 1) {
+      for(uint stride = half / 2; stride > 1; stride >>= 1) {
          barrier(CLK_LOCAL_MEM_FENCE);
-         id = get_local_id(0) + (get_local_id(0)/stride)*stride;
+         id = lid + (lid / stride) * stride;
          SWAP_VECTORS(l_data[id], l_data[id + stride], dir)
       }
 
       barrier(CLK_LOCAL_MEM_FENCE);
-      id = get_local_id(0) * 2;
-      input1 = l_data[id]; input2 = l_data[id+1];
+      id = lid * 2;
+      input1 = l_data[id]; input2 = l_data[id + 1];
       SWAP_VECTORS(input1, input2, dir);
-      SORT_VECTOR(input1, dir);
-      SORT_VECTOR(input2, dir);
+      MERGE_VECTOR(input1, dir);
+      MERGE_VECTOR(input2, dir);
       l_data[id] = input1;
       l_data[id + 1] = input2;
    }
 
-   /* Perform bitonic merge */
-   dir = (get_group_id(0) % 2) * -1;
-   for(uint stride = get_local_size(0); stride > 1; stride >>= 1) {
-      barrier(CLK_LOCAL_MEM_FENCE);
-      id = get_local_id(0) + (get_local_id(0)/stride)*stride;
-      SWAP_VECTORS(l_data[id], l_data[id + stride], dir)
-   }
-   barrier(CLK_LOCAL_MEM_FENCE);
+   store_vector(input1, g_data, global_start, size);
+   store_vector(input2, g_data, global_start + 1, size);
+}
 
-   /* Perform final sort */
-   id = get_local_id(0) * 2;
-   input1 = l_data[id]; input2 = l_data[id+1];
-   SWAP_VECTORS(input1, input2, dir);
-   SORT_VECTOR(input1, dir);
-   SORT_VECTOR(input2, dir);
-   g_data[global_start] = input1;
-   g_data[global_start + 1] = input2;
+//------------------------------------------------------------------------------------------------------------------------------
+
+/* Compare every vector of a run with its mirror in the next run */
+__kernel void bsort_flip(__global SCALAR_TYPE *g_data, __global const uint *offsets, uint size, uint half, int dir) {
+
+   TYPE temp;
+   COMPORATOR_TYPE comp;
+
+   SELECT_SEGMENT(g_data, offsets, size);
+
+   /* Determine location of data in global memory */
+   uint offset = get_global_id(0) % half;
+   uint global_start = (get_global_id(0) / half) * half * 2 + offset;
+   uint mirror = global_start - offset * 2 + half * 2 - 1;
+
+   /* The mirror is padding, so nothing can move */
+   if (mirror * VECTOR_WIDTH >= size) return;
+
+   /* Perform swap */
+   TYPE input1 = load_vector(g_data, global_start, size, dir);
+   TYPE input2 = load_vector(g_data, mirror, size, dir);
 
+   REVERSE_VECTOR(input2);
+   SWAP_VECTORS(input1, input2, dir);
+   REVERSE_VECTOR(input2);
+   store_vector(input1, g_data, global_start, size);
+   store_vector(input2, g_data, mirror, size);
 }
 
 //------------------------------------------------------------------------------------------------------------------------------
 
-/* Sort the bitonic set */
-__kernel void bsort_merge(__global TYPE *g_data, __local TYPE *l_data, uint stage, int dir) {
-   
+/* Compare vectors a stride apart that live in different tiles */
+__kernel void bsort_merge(__global SCALAR_TYPE *g_data, __global const uint *offsets, uint size, uint stride, int dir) {
+
    TYPE temp;
    COMPORATOR_TYPE comp;
 
+   SELECT_SEGMENT(g_data, offsets, size);
+
    /* Determine location of data in global memory */
-   uint global_start  = (get_group_id(0) + (get_group_id(0)/stage)*stage) * 
-      get_local_size(0) + get_local_id(0);
-   uint global_offset = stage * get_local_size(0);
+   uint global_start = get_global_id(0) + (get_global_id(0) / stride) * stride;
+   if ((global_start + stride) * VECTOR_WIDTH >= size) return;
 
    /* Perform swap */
-   TYPE input1 = g_data[global_start];
-   TYPE input2 = g_data[global_start + global_offset];
+   TYPE input1 = load_vector(g_data, global_start, size, dir);
+   TYPE input2 = load_vector(g_data, global_start + stride, size, dir);
 
-   SWAP_VECTORS(input1, input2, dir); 
-   g_data[global_start] = input1;
-   g_data[global_start + global_offset] = input2;
+   SWAP_VECTORS(input1, input2, dir);
+   store_vector(input1, g_data, global_start, size);
+   store_vector(input2, g_data, global_start + stride, size);
 }
 
 //------------------------------------------------------------------------------------------------------------------------------
 
-/* Perform final step of the bitonic merge */
-__kernel void bsort_merge_last(__global TYPE *g_data, __local TYPE *l_data, int dir) {
+/* Largest number of strides a fused merge performs in registers */
+#define MAX_FUSED_STEPS 4
+
+/*
+ * Perform `steps` consecutive strides of the merge in one pass over global memory.
+ * A work-item holds 2^steps vectors, the smallest stride apart, and runs every compare-exchange between them in registers.
+ * `steps` is a constant at every call site, so the loops unroll and the arrays stay in registers.
+ * The kernels own the arrays of 2^steps vectors, so each one takes only the registers of its own depth.
+ */
+void merge_steps(__global SCALAR_TYPE *g_data, TYPE *input, uint size, uint stride, int dir, const uint steps) {
 
    TYPE temp;
    COMPORATOR_TYPE comp;
 
+   /* Determine location of data in global memory */
+   uint step = stride >> (steps - 1);
+   uint global_start = (get_global_id(0) / step) * (step << steps) + get_global_id(0) % step;
+
+   /* Everything above the first vector is padding, so nothing can move */
+   if ((global_start + step) * VECTOR_WIDTH >= size) return;
+
+   for (uint i = 0; i < (1u << steps); ++i)
+      input[i] = load_vector(g_data, global_start + i * step, size, dir);
+
+   for (uint distance = 1u << (steps - 1); distance > 0; distance >>= 1) {
+      for (uint i = 0; i < (1u << steps); ++i) {
+         if (i & distance) continue;
+         SWAP_VECTORS(input[i], input[i + distance], dir);
+      }
+   }
+
+   for (uint i = 0; i < (1u << steps); ++i)
+      store_vector(input[i], g_data, global_start + i * step, size);
+}
+
+__kernel void bsort_merge2(__global SCALAR_TYPE *g_data, __global const uint *offsets, uint size, uint stride, int dir) {
+   TYPE input[1 << 2];
+   SELECT_SEGMENT(g_data, offsets, size);
+   merge_steps(g_data, input, size, stride, dir, 2);
+}
+
+__kernel void bsort_merge3(__global SCALAR_TYPE *g_data, __global const uint *offsets, uint size, uint stride, int dir) {
+   TYPE input[1 << 3];
+   SELECT_SEGMENT(g_data, offsets, size);
+   merge_steps(g_data, input, size, stride, dir, 3);
+}
+
+__kernel void bsort_merge4(__global SCALAR_TYPE *g_data, __global const uint *offsets, uint size, uint stride, int dir) {
+   TYPE input[1 << 4];
+   SELECT_SEGMENT(g_data, offsets, size);
+   merge_steps(g_data, input, size, stride, dir, 4);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+/* Perform the steps of the merge that fit into a tile */
+__kernel void bsort_merge_last(__global SCALAR_TYPE *g_data, __global const uint *offsets, __local TYPE *l_data, uint size, int dir) {
+
+   TYPE temp;
+   COMPORATOR_TYPE comp;
+
+   /* Work-groups past the end of a short segment have nothing to sort */
+   SELECT_SEGMENT(g_data, offsets, size);
+   if (get_group_id(0) * get_local_size(0) * 2 * VECTOR_WIDTH >= size) return;
+
    /* Determine location of data in global memory */
    uint id = get_local_id(0);
    uint global_start = get_group_id(0) * get_local_size(0) * 2 + id;
 
    /* Perform initial swap */
-   TYPE input1 = g_data[global_start];
-   TYPE input2 = g_data[global_start + get_local_size(0)];
+   TYPE input1 = load_vector(g_data, global_start, size, dir);
+   TYPE input2 = load_vector(g_data, global_start + get_local_size(0), size, dir);
 
    SWAP_VECTORS(input1, input2, dir);
    l_data[id] = input1;
@@ -162,31 +488,384 @@ __kernel void bsort_merge_last(__global TYPE *g_data, __local TYPE *l_data, int
    id = get_local_id(0) * 2;
    input1 = l_data[id]; input2 = l_data[id+1];
    SWAP_VECTORS(input1, input2, dir);
-   SORT_VECTOR(input1, dir);
-   SORT_VECTOR(input2, dir);
+   MERGE_VECTOR(input1, dir);
+   MERGE_VECTOR(input2, dir);
 
    /* Store the result to global memory */
-   g_data[global_start + get_local_id(0)] = input1;
-   g_data[global_start + get_local_id(0) + 1] = input2;
+   store_vector(input1, g_data, global_start + get_local_id(0), size);
+   store_vector(input2, g_data, global_start + get_local_id(0) + 1, size);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+/*
+ * Keep the first `run` vectors of every two neighbouring sorted runs, dropping the other half.
+ * Every vector of the first run is compared with its mirror in the second one, as in bsort_flip, but only the winners are
+ * written, packed into g_out. They form a bitonic run, which bsort_merge and bsort_merge_last sort afterwards.
+ * A missing second run is padding, and padding written to g_out is sorted along as the largest value.
+ */
+__kernel void bsort_topk(__global const SCALAR_TYPE *g_data, __global SCALAR_TYPE *g_out, uint size, uint run, int dir) {
+
+   TYPE temp;
+   COMPORATOR_TYPE comp;
+
+   uint offset = get_global_id(0) % run;
+   uint pair = get_global_id(0) / run;
+   uint global_start = pair * run * 2 + offset;
+   uint mirror = global_start - offset * 2 + run * 2 - 1;
+
+   TYPE input1 = load_vector(g_data, global_start, size, dir);
+   TYPE input2 = load_vector(g_data, mirror, size, dir);
+
+   REVERSE_VECTOR(input2);
+   SWAP_VECTORS(input1, input2, dir);
+   VSTORE(input1, get_global_id(0), g_out);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+/*
+ * Merge path search: the first `split` elements of a and the first diagonal - split of b make up the first `diagonal`
+ * elements of their merge. Equal elements are taken from a first, so the merge is stable.
+ */
+#define MERGE_PATH(a, a_size, b, b_size, diagonal, dir, split)                                                       \
+   split = (diagonal) > (b_size) ? (diagonal) - (b_size) : 0;                                                        \
+   for (uint high = min((uint)(diagonal), (uint)(a_size)); split < high; ) {                                         \
+      uint mid = (split + high) / 2;                                                                                 \
+      if (BEFORE((b)[(diagonal) - mid - 1], (a)[mid], dir)) high = mid;                                              \
+      else split = mid + 1;                                                                                          \
+   }
+
+/*
+ * Merge two sorted arrays into g_out, every work-group writes a tile of `items` elements per work-item.
+ * The group finds its parts of both inputs, loads them into local memory and stores the merged tile with
+ * consecutive work-items on consecutive elements. In between each work-item merges `items` outputs out of local memory.
+ * l_data holds two tiles, the inputs and the merged output.
+ */
+__kernel void bsort_merge_path(__global const SCALAR_TYPE *g_a, uint a_size, __global const SCALAR_TYPE *g_b, uint b_size,
+                               __global SCALAR_TYPE *g_out, __local SCALAR_TYPE *l_data, uint items, int dir) {
+
+   uint lid = get_local_id(0);
+   uint local_size = get_local_size(0);
+   uint tile = local_size * items;
+   uint size = a_size + b_size;
+   uint first = min((uint)get_group_id(0) * tile, size);
+   uint last = min(first + tile, size);
+   uint count = last - first;
+
+   /* Every work-item of the group searches the same diagonals, so the reads are shared */
+   uint a_first, a_last;
+   MERGE_PATH(g_a, a_size, g_b, b_size, first, dir, a_first);
+   MERGE_PATH(g_a, a_size, g_b, b_size, last, dir, a_last);
+   uint a_count = a_last - a_first;
+   uint b_count = count - a_count;
+   uint b_first = first - a_first;
+
+   __local SCALAR_TYPE *l_a = l_data;
+   __local SCALAR_TYPE *l_b = l_data + a_count;
+   __local SCALAR_TYPE *l_out = l_data + tile;
+   for (uint k = lid; k < count; k += local_size)
+      l_data[k] = k < a_count ? g_a[a_first + k] : g_b[b_first + k - a_count];
+   barrier(CLK_LOCAL_MEM_FENCE);
+
+   uint diagonal = min(lid * items, count);
+   uint end = min(diagonal + items, count);
+   uint i;
+   MERGE_PATH(l_a, a_count, l_b, b_count, diagonal, dir, i);
+   uint j = diagonal - i;
+   for (uint k = diagonal; k < end; ++k) {
+      bool take_a = j >= b_count || (i < a_count && !BEFORE(l_b[j], l_a[i], dir));
+      l_out[k] = take_a ? l_a[i++] : l_b[j++];
+   }
+   barrier(CLK_LOCAL_MEM_FENCE);
+
+   for (uint k = lid; k < count; k += local_size)
+      g_out[first + k] = l_out[k];
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+/* Load a vector of values, padding values only matter when they break key ties */
+VALUE_VECTOR load_values(__global const VALUE_TYPE *g_values, uint index, uint size, int dir) {
+
+   uint first = index * VECTOR_WIDTH;
+   if (first + VECTOR_WIDTH <= size)
+      return VLOAD(index, g_values);
+
+   VALUE_TYPE tail[VECTOR_WIDTH];
+   for (uint i = 0; i < VECTOR_WIDTH; ++i)
+      tail[i] = (first + i < size) ? g_values[first + i] : VALUE_PADDING(dir);
+   return VLOAD(0, tail);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+/* Store a vector of values, dropping the elements past the end of the array */
+void store_values(VALUE_VECTOR value, __global VALUE_TYPE *g_values, uint index, uint size) {
+
+   uint first = index * VECTOR_WIDTH;
+   if (first + VECTOR_WIDTH <= size) {
+      VSTORE(value, index, g_values);
+      return;
+   }
+
+   VALUE_TYPE tail[VECTOR_WIDTH];
+   VSTORE(value, 0, tail);
+   for (uint i = 0; i < VECTOR_WIDTH && first + i < size; ++i)
+      g_values[first + i] = tail[i];
+}
+
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+/*
+ * Key-value variants of the kernels above. Every move of a key is applied to the value at the same position,
+ * so sorting the values 0..N-1 along with the keys yields the sorting permutation.
+ */
+
+/* Perform initial sort of a tile of keys and values */
+__kernel void bsort_kv_init(__global SCALAR_TYPE *g_keys, __global VALUE_TYPE *g_values, __global const uint *offsets,
+                            __local TYPE *l_keys, __local VALUE_VECTOR *l_values, uint size, int dir) {
+
+   TYPE temp;
+   VALUE_VECTOR value_temp;
+   COMPORATOR_TYPE comp;
+
+   /* Work-groups past the end of a short segment have nothing to sort */
+   SELECT_SEGMENT(g_keys, offsets, size);
+   SELECT_SEGMENT(g_values, offsets, size);
+   if (get_group_id(0) * get_local_size(0) * 2 * VECTOR_WIDTH >= size) return;
+
+   uint lid = get_local_id(0);
+   uint id = lid * 2;
+   uint global_start = get_group_id(0) * get_local_size(0) * 2 + id;
+
+   TYPE key1 = load_vector(g_keys, global_start, size, dir);
+   TYPE key2 = load_vector(g_keys, global_start + 1, size, dir);
+   VALUE_VECTOR value1 = load_values(g_values, global_start, size, dir);
+   VALUE_VECTOR value2 = load_values(g_values, global_start + 1, size, dir);
+
+   /* Sort the 2 * VECTOR_WIDTH elements held by the work-item */
+   SORT_VECTOR_KV(key1, value1, dir);
+   SORT_VECTOR_KV(key2, value2, dir);
+   REVERSE_VECTOR(key2);
+   REVERSE_VALUES(value2);
+   SWAP_VECTORS_KV(key1, value1, key2, value2, dir);
+   REVERSE_VECTOR(key2);
+   REVERSE_VALUES(value2);
+   MERGE_VECTOR_KV(key1, value1, dir);
+   MERGE_VECTOR_KV(key2, value2, dir);
+   l_keys[id] = key1;     l_keys[id + 1] = key2;
+   l_values[id] = value1; l_values[id + 1] = value2;
+
+   /* Merge runs of `half` vectors until the whole tile is sorted */
+   for(uint half = 2; half <= get_local_size(0); half <<= 1) {
+      barrier(CLK_LOCAL_MEM_FENCE);
+      uint offset = lid % half;
+      id = (lid / half) * half * 2 + offset;
+      uint mirror = id - offset * 2 + half * 2 - 1;
+
+      key1 = l_keys[id];     key2 = l_keys[mirror];
+      value1 = l_values[id]; value2 = l_values[mirror];
+      REVERSE_VECTOR(key2);
+      REVERSE_VALUES(value2);
+      SWAP_VECTORS_KV(key1, value1, key2, value2, dir);
+      REVERSE_VECTOR(key2);
+      REVERSE_VALUES(value2);
+      l_keys[id] = key1;     l_keys[mirror] = key2;
+      l_values[id] = value1; l_values[mirror] = value2;
+
+      for(uint stride = half / 2; stride > 1; stride >>= 1) {
+         barrier(CLK_LOCAL_MEM_FENCE);
+         id = lid + (lid / stride) * stride;
+         SWAP_VECTORS_KV(l_keys[id], l_values[id], l_keys[id + stride], l_values[id + stride], dir)
+      }
+
+      barrier(CLK_LOCAL_MEM_FENCE);
+      id = lid * 2;
+      key1 = l_keys[id];     key2 = l_keys[id + 1];
+      value1 = l_values[id]; value2 = l_values[id + 1];
+      SWAP_VECTORS_KV(key1, value1, key2, value2, dir);
+      MERGE_VECTOR_KV(key1, value1, dir);
+      MERGE_VECTOR_KV(key2, value2, dir);
+      l_keys[id] = key1;     l_keys[id + 1] = key2;
+      l_values[id] = value1; l_values[id + 1] = value2;
+   }
+
+   store_vector(key1, g_keys, global_start, size);
+   store_vector(key2, g_keys, global_start + 1, size);
+   store_values(value1, g_values, global_start, size);
+   store_values(value2, g_values, global_start + 1, size);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+/* Compare every key vector of a run with its mirror in the next run */
+__kernel void bsort_kv_flip(__global SCALAR_TYPE *g_keys, __global VALUE_TYPE *g_values, __global const uint *offsets,
+                            uint size, uint half, int dir) {
+
+   TYPE temp;
+   VALUE_VECTOR value_temp;
+   COMPORATOR_TYPE comp;
+
+   SELECT_SEGMENT(g_keys, offsets, size);
+   SELECT_SEGMENT(g_values, offsets, size);
+
+   uint offset = get_global_id(0) % half;
+   uint global_start = (get_global_id(0) / half) * half * 2 + offset;
+   uint mirror = global_start - offset * 2 + half * 2 - 1;
+
+   if (mirror * VECTOR_WIDTH >= size) return;
+
+   TYPE key1 = load_vector(g_keys, global_start, size, dir);
+   TYPE key2 = load_vector(g_keys, mirror, size, dir);
+   VALUE_VECTOR value1 = load_values(g_values, global_start, size, dir);
+   VALUE_VECTOR value2 = load_values(g_values, mirror, size, dir);
+
+   REVERSE_VECTOR(key2);
+   REVERSE_VALUES(value2);
+   SWAP_VECTORS_KV(key1, value1, key2, value2, dir);
+   REVERSE_VECTOR(key2);
+   REVERSE_VALUES(value2);
+
+   store_vector(key1, g_keys, global_start, size);
+   store_vector(key2, g_keys, mirror, size);
+   store_values(value1, g_values, global_start, size);
+   store_values(value2, g_values, mirror, size);
 }
 
 //------------------------------------------------------------------------------------------------------------------------------
 
-/* Perform successive stages of the bitonic sort */
-__kernel void bsort_first_stage(__global TYPE *g_data, __local TYPE *l_data, uint stage, uint high_stage) {
-   
-   int dir = (get_group_id(0)/high_stage & 1) * -1;
-   bsort_merge(g_data, l_data, stage, dir);
+/* Compare key vectors a stride apart that live in different tiles */
+__kernel void bsort_kv_merge(__global SCALAR_TYPE *g_keys, __global VALUE_TYPE *g_values, __global const uint *offsets,
+                             uint size, uint stride, int dir) {
+
+   TYPE temp;
+   VALUE_VECTOR value_temp;
+   COMPORATOR_TYPE comp;
+
+   SELECT_SEGMENT(g_keys, offsets, size);
+   SELECT_SEGMENT(g_values, offsets, size);
+
+   uint global_start = get_global_id(0) + (get_global_id(0) / stride) * stride;
+   if ((global_start + stride) * VECTOR_WIDTH >= size) return;
+
+   TYPE key1 = load_vector(g_keys, global_start, size, dir);
+   TYPE key2 = load_vector(g_keys, global_start + stride, size, dir);
+   VALUE_VECTOR value1 = load_values(g_values, global_start, size, dir);
+   VALUE_VECTOR value2 = load_values(g_values, global_start + stride, size, dir);
+
+   SWAP_VECTORS_KV(key1, value1, key2, value2, dir);
+
+   store_vector(key1, g_keys, global_start, size);
+   store_vector(key2, g_keys, global_start + stride, size);
+   store_values(value1, g_values, global_start, size);
+   store_values(value2, g_values, global_start + stride, size);
 }
 
 //------------------------------------------------------------------------------------------------------------------------------
 
-/* Perform lowest stage of the bitonic sort */
-__kernel void bsort_second_stage(__global TYPE *g_data, __local TYPE *l_data, uint high_stage) {
+/* Perform `steps` consecutive strides of the key-value merge in one pass over global memory */
+void merge_steps_kv(__global SCALAR_TYPE *g_keys, __global VALUE_TYPE *g_values, TYPE *key, VALUE_VECTOR *value,
+                    uint size, uint stride, int dir, const uint steps) {
 
-   int dir = (get_group_id(0)/high_stage & 1) * -1;
-   bsort_merge_last(g_data, l_data, dir);
+   TYPE temp;
+   VALUE_VECTOR value_temp;
+   COMPORATOR_TYPE comp;
+
+   uint step = stride >> (steps - 1);
+   uint global_start = (get_global_id(0) / step) * (step << steps) + get_global_id(0) % step;
+
+   if ((global_start + step) * VECTOR_WIDTH >= size) return;
+
+   for (uint i = 0; i < (1u << steps); ++i) {
+      key[i] = load_vector(g_keys, global_start + i * step, size, dir);
+      value[i] = load_values(g_values, global_start + i * step, size, dir);
+   }
+
+   for (uint distance = 1u << (steps - 1); distance > 0; distance >>= 1) {
+      for (uint i = 0; i < (1u << steps); ++i) {
+         if (i & distance) continue;
+         SWAP_VECTORS_KV(key[i], value[i], key[i + distance], value[i + distance], dir);
+      }
+   }
+
+   for (uint i = 0; i < (1u << steps); ++i) {
+      store_vector(key[i], g_keys, global_start + i * step, size);
+      store_values(value[i], g_values, global_start + i * step, size);
+   }
 }
 
+__kernel void bsort_kv_merge2(__global SCALAR_TYPE *g_keys, __global VALUE_TYPE *g_values, __global const uint *offsets,
+                              uint size, uint stride, int dir) {
+   TYPE key[1 << 2];
+   VALUE_VECTOR value[1 << 2];
+   SELECT_SEGMENT(g_keys, offsets, size);
+   SELECT_SEGMENT(g_values, offsets, size);
+   merge_steps_kv(g_keys, g_values, key, value, size, stride, dir, 2);
+}
 
+__kernel void bsort_kv_merge3(__global SCALAR_TYPE *g_keys, __global VALUE_TYPE *g_values, __global const uint *offsets,
+                              uint size, uint stride, int dir) {
+   TYPE key[1 << 3];
+   VALUE_VECTOR value[1 << 3];
+   SELECT_SEGMENT(g_keys, offsets, size);
+   SELECT_SEGMENT(g_values, offsets, size);
+   merge_steps_kv(g_keys, g_values, key, value, size, stride, dir, 3);
+}
+
+__kernel void bsort_kv_merge4(__global SCALAR_TYPE *g_keys, __global VALUE_TYPE *g_values, __global const uint *offsets,
+                              uint size, uint stride, int dir) {
+   TYPE key[1 << 4];
+   VALUE_VECTOR value[1 << 4];
+   SELECT_SEGMENT(g_keys, offsets, size);
+   SELECT_SEGMENT(g_values, offsets, size);
+   merge_steps_kv(g_keys, g_values, key, value, size, stride, dir, 4);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+/* Perform the steps of the key-value merge that fit into a tile */
+__kernel void bsort_kv_merge_last(__global SCALAR_TYPE *g_keys, __global VALUE_TYPE *g_values, __global const uint *offsets,
+                                  __local TYPE *l_keys, __local VALUE_VECTOR *l_values, uint size, int dir) {
 
+   TYPE temp;
+   VALUE_VECTOR value_temp;
+   COMPORATOR_TYPE comp;
+
+   /* Work-groups past the end of a short segment have nothing to sort */
+   SELECT_SEGMENT(g_keys, offsets, size);
+   SELECT_SEGMENT(g_values, offsets, size);
+   if (get_group_id(0) * get_local_size(0) * 2 * VECTOR_WIDTH >= size) return;
+
+   uint id = get_local_id(0);
+   uint global_start = get_group_id(0) * get_local_size(0) * 2 + id;
+
+   TYPE key1 = load_vector(g_keys, global_start, size, dir);
+   TYPE key2 = load_vector(g_keys, global_start + get_local_size(0), size, dir);
+   VALUE_VECTOR value1 = load_values(g_values, global_start, size, dir);
+   VALUE_VECTOR value2 = load_values(g_values, global_start + get_local_size(0), size, dir);
+
+   SWAP_VECTORS_KV(key1, value1, key2, value2, dir);
+   l_keys[id] = key1;     l_keys[id + get_local_size(0)] = key2;
+   l_values[id] = value1; l_values[id + get_local_size(0)] = value2;
+
+   for(uint stride = get_local_size(0)/2; stride > 1; stride >>= 1) {
+      barrier(CLK_LOCAL_MEM_FENCE);
+      id = get_local_id(0) + (get_local_id(0)/stride)*stride;
+      SWAP_VECTORS_KV(l_keys[id], l_values[id], l_keys[id + stride], l_values[id + stride], dir)
+   }
+   barrier(CLK_LOCAL_MEM_FENCE);
+
+   id = get_local_id(0) * 2;
+   key1 = l_keys[id];     key2 = l_keys[id + 1];
+   value1 = l_values[id]; value2 = l_values[id + 1];
+   SWAP_VECTORS_KV(key1, value1, key2, value2, dir);
+   MERGE_VECTOR_KV(key1, value1, dir);
+   MERGE_VECTOR_KV(key2, value2, dir);
+
+   store_vector(key1, g_keys, global_start + get_local_id(0), size);
+   store_vector(key2, g_keys, global_start + get_local_id(0) + 1, size);
+   store_values(value1, g_values, global_start + get_local_id(0), size);
+   store_values(value2, g_values, global_start + get_local_id(0) + 1, size);
+}
@@ -0,0 +1,179 @@
+
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+
+/* Template parameters for the sorting of a given type of keys */
+// #define KEY_TYPE float
+// #define BITS_TYPE uint
+// #define KEY_FLOAT
+// #define KEY_SIGNED
+
+#define CAT(a, b) a ## b
+#define XCAT(a, b) CAT(a, b)
+
+#define UP 0
+#define DOWN -1
+
+/* Bits of a digit, every pass sorts the keys by one digit */
+#define RADIX_BITS 4
+#define RADIX (1 << RADIX_BITS)
+
+#define AS_BITS XCAT(as_, BITS_TYPE)
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+/* Bits of a key as an unsigned integer of the same order */
+BITS_TYPE key_bits(KEY_TYPE key) {
+
+   BITS_TYPE bits = AS_BITS(key);
+   BITS_TYPE sign = (BITS_TYPE)1 << (sizeof(BITS_TYPE) * 8 - 1);
+#if defined(KEY_FLOAT)
+   /* NaNs go after every number, as in bsort.cl, whatever their sign and payload */
+   if (isnan(key)) return ~(BITS_TYPE)0;
+   /* Negative floats grow towards zero, so all their bits are flipped, positive ones only get the sign set */
+   return bits ^ ((bits & sign) ? ~(BITS_TYPE)0 : sign);
+#elif defined(KEY_SIGNED)
+   return bits ^ sign;
+#else
+   return bits;
+#endif
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+/* Digit of a key at the given shift, reversed for the descending order */
+uint key_digit(KEY_TYPE key, uint shift, int dir) {
+
+   uint digit = (uint)(key_bits(key) >> shift) & (RADIX - 1);
+   return dir == UP ? digit : RADIX - 1 - digit;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+/* Range of keys of the work-group, whole tiles of local size keys, so the work-groups of a pass cover the array in order */
+void group_range(uint size, uint *first, uint *last) {
+
+   uint local_size = get_local_size(0);
+   uint groups = get_num_groups(0);
+   uint group = get_group_id(0);
+   uint tiles = (size + local_size - 1) / local_size;
+   uint range = (tiles + groups - 1) / groups * local_size;
+   *first = min(group * range, size);
+   *last = min(*first + range, size);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+/* Exclusive prefix sum of one value per work-item */
+uint local_scan(__local uint *l_sums, uint value) {
+
+   uint lid = get_local_id(0);
+   l_sums[lid] = value;
+   for (uint distance = 1; distance < get_local_size(0); distance <<= 1) {
+      barrier(CLK_LOCAL_MEM_FENCE);
+      uint add = lid >= distance ? l_sums[lid - distance] : 0;
+      barrier(CLK_LOCAL_MEM_FENCE);
+      l_sums[lid] += add;
+   }
+   barrier(CLK_LOCAL_MEM_FENCE);
+   uint sum = l_sums[lid] - value;
+   barrier(CLK_LOCAL_MEM_FENCE);
+   return sum;
+}
+
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+/*
+ * One pass of the LSD radix sort takes three launches:
+ * radix_histogram counts the digits of every work-group's range, digit-major, so that
+ * radix_scan turns the counts into the first position of every digit of every work-group, and
+ * radix_scatter moves the keys there, keeping the order of equal digits, which makes every pass stable.
+ */
+
+/* Count the digits of the keys of the work-group */
+__kernel void radix_histogram(__global const KEY_TYPE *g_keys, __global uint *g_counts, __local uint *l_counts,
+                              uint size, uint shift, int dir) {
+
+   uint lid = get_local_id(0);
+   for (uint digit = lid; digit < RADIX; digit += get_local_size(0)) l_counts[digit] = 0;
+   barrier(CLK_LOCAL_MEM_FENCE);
+
+   uint first, last;
+   group_range(size, &first, &last);
+   for (uint i = first + lid; i < last; i += get_local_size(0))
+      atomic_inc(&l_counts[key_digit(g_keys[i], shift, dir)]);
+   barrier(CLK_LOCAL_MEM_FENCE);
+
+   for (uint digit = lid; digit < RADIX; digit += get_local_size(0))
+      g_counts[digit * get_num_groups(0) + get_group_id(0)] = l_counts[digit];
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+/* Exclusive prefix sum of all counts in place, run by a single work-group */
+__kernel void radix_scan(__global uint *g_counts, __local uint *l_sums, uint count) {
+
+   /* Every work-item sums a chunk of the counts, the chunk sums are scanned in local memory */
+   uint lid = get_local_id(0);
+   uint chunk = (count + get_local_size(0) - 1) / get_local_size(0);
+   uint first = min(lid * chunk, count);
+   uint last = min(first + chunk, count);
+
+   uint sum = 0;
+   for (uint i = first; i < last; ++i) sum += g_counts[i];
+
+   uint offset = local_scan(l_sums, sum);
+   for (uint i = first; i < last; ++i) {
+      uint value = g_counts[i];
+      g_counts[i] = offset;
+      offset += value;
+   }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+/* Move the keys of the work-group to their positions for the digit, tile by tile */
+__kernel void radix_scatter(__global const KEY_TYPE *g_keys, __global KEY_TYPE *g_out, __global const uint *g_offsets,
+                            __local uint *l_ranks, __local uint *l_sums, __local uint *l_base, uint size, uint shift, int dir) {
+
+   uint lid = get_local_id(0);
+   uint local_size = get_local_size(0);
+   for (uint digit = lid; digit < RADIX; digit += local_size)
+      l_base[digit] = g_offsets[digit * get_num_groups(0) + get_group_id(0)];
+
+   uint first, last;
+   group_range(size, &first, &last);
+   for (uint tile = first; tile < last; tile += local_size) {
+      uint i = tile + lid;
+      KEY_TYPE key = 0;
+      uint digit = RADIX;
+      if (i < last) {
+         key = g_keys[i];
+         digit = key_digit(key, shift, dir);
+      }
+
+      /* Flags are digit-major, so their prefix sum ranks the tile by digit, then by position */
+      for (uint d = 0; d < RADIX; ++d) l_ranks[d * local_size + lid] = (digit == d);
+      barrier(CLK_LOCAL_MEM_FENCE);
+
+      uint sum = 0;
+      for (uint d = 0; d < RADIX; ++d) sum += l_ranks[lid * RADIX + d];
+      uint offset = local_scan(l_sums, sum);
+      for (uint d = 0; d < RADIX; ++d) {
+         uint flag = l_ranks[lid * RADIX + d];
+         l_ranks[lid * RADIX + d] = offset;
+         offset += flag;
+      }
+      barrier(CLK_LOCAL_MEM_FENCE);
+
+      if (digit < RADIX)
+         g_out[l_base[digit] + l_ranks[digit * local_size + lid] - l_ranks[digit * local_size]] = key;
+      barrier(CLK_LOCAL_MEM_FENCE);
+
+      /* Keys of the next tile go after those of this one */
+      uint count = min(last - tile, local_size);
+      for (uint d = lid; d < RADIX; d += local_size)
+         l_base[d] += (d + 1 < RADIX ? l_ranks[(d + 1) * local_size] : count) - l_ranks[d * local_size];
+      barrier(CLK_LOCAL_MEM_FENCE);
+   }
+}
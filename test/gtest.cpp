@@ -1,7 +1,20 @@
 #include <gtest/gtest.h>
 #include "BitonicSorter.hpp"
+#include "ColumnSort.hpp"
+#include "ConcurrentSorter.hpp"
+#include "ExternalSort.hpp"
+#include "StreamSort.hpp"
 #include <random>
 #include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <sstream>
+#include <tuple>
+#include <thread>
 
 const int SMALL_SIZE = 10;
 const int BIG_SIZE = 1 << 22;
@@ -12,6 +25,9 @@ const int BIG_SIZE = 1 << 22;
 
 #define USE_PLATFORM "NVIDIA"
 
+using Half = OpenCLApp::Half;
+using UInt128 = OpenCLApp::UInt128;
+
 //------------------------------------------------------------------------------------------------------------------------------
 
 
@@ -29,18 +45,22 @@ bool operator == (std::vector<T>& lhs, std::vector<T>& rhs) {
 //------------------------------------------------------------------------------------------------------------------------------
 
 template <typename T> 
-void TestBody(size_t size, OpenCLApp::SortDirection direction) {
+void TestBody(size_t size, OpenCLApp::SortDirection direction, OpenCLApp::SortAlgorithm algorithm) {
     OpenCLApp::BitonicSorter<T> sort(USE_PLATFORM);
+    sort.setHostThreshold(0);
+    sort.setAlgorithm(algorithm);
 
     auto rigth_border = std::numeric_limits<T>::max();
     auto left_border  = std::numeric_limits<T>::lowest();
 
     std::random_device rd;
     std::mt19937 gen(rd());
-    std::uniform_int_distribution<T> random(left_border, rigth_border);
+    /* uniform_int_distribution doesn't take 8-bit types */
+    using Draw = std::conditional_t<sizeof(T) == 1, int, T>;
+    std::uniform_int_distribution<Draw> random(left_border, rigth_border);
     
     std::vector<T> data(size);
-    for (auto& x: data) x = random(gen);
+    for (auto& x: data) x = static_cast<T>(random(gen));
 
     std::vector<T> copy = data;
     sort(data.begin(), data.end(), direction);
@@ -59,10 +79,12 @@ void TestBody(size_t size, OpenCLApp::SortDirection direction) {
 
 
 template <> 
-void TestBody<float>(size_t size, OpenCLApp::SortDirection direction) {
+void TestBody<float>(size_t size, OpenCLApp::SortDirection direction, OpenCLApp::SortAlgorithm algorithm) {
     using T = float;
     
     OpenCLApp::BitonicSorter<T> sort(USE_PLATFORM);
+    sort.setHostThreshold(0);
+    sort.setAlgorithm(algorithm);
 
     std::random_device rd;
     std::mt19937 gen(rd());
@@ -86,10 +108,12 @@ void TestBody<float>(size_t size, OpenCLApp::SortDirection direction) {
 
 
 template <> 
-void TestBody<double>(size_t size, OpenCLApp::SortDirection direction) {
+void TestBody<double>(size_t size, OpenCLApp::SortDirection direction, OpenCLApp::SortAlgorithm algorithm) {
     using T = double;
     
     OpenCLApp::BitonicSorter<T> sort(USE_PLATFORM);
+    sort.setHostThreshold(0);
+    sort.setAlgorithm(algorithm);
 
     std::random_device rd;
     std::mt19937 gen(rd());
@@ -113,22 +137,104 @@ void TestBody<double>(size_t size, OpenCLApp::SortDirection direction) {
 //------------------------------------------------------------------------------------------------------------------------------
 
 
-#define TYPE_TEST_CREATER(type)                                     \
-    TEST(BitonicSortTest, test_##type##_1) {                        \
-        ::TestBody<type>(SMALL_SIZE, OpenCLApp::INCREASING);        \
-    }                                                               \
-                                                                    \
-    TEST(BitonicSortTest, test_##type##_2) {                        \
-        ::TestBody<type>(BIG_SIZE, OpenCLApp::INCREASING);          \
-    }                                                               \
-                                                                    \
-    TEST(BitonicSortTest, test_##type##_3) {                        \
-        ::TestBody<type>(SMALL_SIZE, OpenCLApp::DECREASING);        \
-    }                                                               \
-                                                                    \
-    TEST(BitonicSortTest, test_##type##_4) {                        \
-        ::TestBody<type>(BIG_SIZE, OpenCLApp::DECREASING);          \
-    }                                                               
+template <> 
+void TestBody<Half>(size_t size, OpenCLApp::SortDirection direction, OpenCLApp::SortAlgorithm algorithm) {
+    using T = Half;
+
+    auto& device = OpenCLApp::SortEngine::instance(USE_PLATFORM).devices()[0];
+    if (device.getInfo<CL_DEVICE_EXTENSIONS>().find("cl_khr_fp16") == std::string::npos)
+        GTEST_SKIP() << "Device doesn't support half precision";
+
+    OpenCLApp::BitonicSorter<T> sort(USE_PLATFORM);
+    sort.setHostThreshold(0);
+    sort.setAlgorithm(algorithm);
+
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_real_distribution<float> random(-1000.0f, 1000.0f);
+    
+    std::vector<T> data(size);
+    for (auto& x: data) x = T {random(gen)};
+
+    std::vector<T> copy = data;
+    sort(data.begin(), data.end(), direction);
+
+    if (direction == OpenCLApp::INCREASING)
+        std::sort(copy.begin(), copy.end());
+    else 
+        std::sort(copy.begin(), copy.end(), std::greater());
+
+    EXPECT_EQ(data, copy);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+
+template <> 
+void TestBody<UInt128>(size_t size, OpenCLApp::SortDirection direction, OpenCLApp::SortAlgorithm algorithm) {
+    using T = UInt128;
+    
+    OpenCLApp::BitonicSorter<T> sort(USE_PLATFORM);
+    sort.setHostThreshold(0);
+    sort.setAlgorithm(algorithm);
+
+    /* Few distinct high halves, so most orderings are decided by the low ones */
+    std::random_device rd;
+    std::mt19937_64 gen(rd());
+    std::uniform_int_distribution<uint64_t> high(0, 16);
+    std::uniform_int_distribution<uint64_t> low;
+    
+    std::vector<T> data(size);
+    for (auto& x: data) x = T {high(gen), low(gen)};
+
+    std::vector<T> copy = data;
+    sort(data.begin(), data.end(), direction);
+
+    if (direction == OpenCLApp::INCREASING)
+        std::sort(copy.begin(), copy.end());
+    else 
+        std::sort(copy.begin(), copy.end(), std::greater());
+
+    EXPECT_EQ(data, copy);
+}
+
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+
+/* Both engines against std::sort, types without a radix sort run the network for RADIX */
+#define TYPE_TEST_CREATER(type)                                                              \
+    TEST(BitonicSortTest, test_##type##_1) {                                                 \
+        ::TestBody<type>(SMALL_SIZE, OpenCLApp::INCREASING, OpenCLApp::BITONIC);             \
+    }                                                                                        \
+                                                                                             \
+    TEST(BitonicSortTest, test_##type##_2) {                                                 \
+        ::TestBody<type>(BIG_SIZE, OpenCLApp::INCREASING, OpenCLApp::BITONIC);               \
+    }                                                                                        \
+                                                                                             \
+    TEST(BitonicSortTest, test_##type##_3) {                                                 \
+        ::TestBody<type>(SMALL_SIZE, OpenCLApp::DECREASING, OpenCLApp::BITONIC);             \
+    }                                                                                        \
+                                                                                             \
+    TEST(BitonicSortTest, test_##type##_4) {                                                 \
+        ::TestBody<type>(BIG_SIZE, OpenCLApp::DECREASING, OpenCLApp::BITONIC);               \
+    }                                                                                        \
+                                                                                             \
+    TEST(BitonicSortTest, test_##type##_radix_1) {                                           \
+        ::TestBody<type>(SMALL_SIZE, OpenCLApp::INCREASING, OpenCLApp::RADIX);               \
+    }                                                                                        \
+                                                                                             \
+    TEST(BitonicSortTest, test_##type##_radix_2) {                                           \
+        ::TestBody<type>(BIG_SIZE, OpenCLApp::INCREASING, OpenCLApp::RADIX);                 \
+    }                                                                                        \
+                                                                                             \
+    TEST(BitonicSortTest, test_##type##_radix_3) {                                           \
+        ::TestBody<type>(SMALL_SIZE, OpenCLApp::DECREASING, OpenCLApp::RADIX);               \
+    }                                                                                        \
+                                                                                             \
+    TEST(BitonicSortTest, test_##type##_radix_4) {                                           \
+        ::TestBody<type>(BIG_SIZE, OpenCLApp::DECREASING, OpenCLApp::RADIX);                 \
+    }                                                                                        
 
 
 //------------------------------------------------------------------------------------------------------------------------------
@@ -145,6 +251,978 @@ TYPE_TEST_CREATER(int64_t)
 
 TYPE_TEST_CREATER(uint64_t)
 
+TYPE_TEST_CREATER(int8_t)
+
+TYPE_TEST_CREATER(uint8_t)
+
+TYPE_TEST_CREATER(int16_t)
+
+TYPE_TEST_CREATER(uint16_t)
+
+TYPE_TEST_CREATER(Half)
+
+TYPE_TEST_CREATER(UInt128)
+
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+TEST(BitonicSortTest, test_arbitrary_size) {
+    OpenCLApp::BitonicSorter<int> sort(USE_PLATFORM);
+    sort.setHostThreshold(0);
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> random(-1000, 1000);
+
+    for (size_t size: {1, 2, 3, 17, 1000, 4097, (1 << 20) + 1}) {
+        for (auto direction: {OpenCLApp::INCREASING, OpenCLApp::DECREASING}) {
+            std::vector<int> data(size);
+            for (auto& x: data) x = random(gen);
+
+            std::vector<int> copy = data;
+            sort(data.begin(), data.end(), direction);
+
+            if (direction == OpenCLApp::INCREASING)
+                std::sort(copy.begin(), copy.end());
+            else
+                std::sort(copy.begin(), copy.end(), std::greater());
+
+            EXPECT_EQ(data, copy);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+TEST(BitonicSortTest, test_buffer_reuse) {
+    OpenCLApp::BitonicSorter<int> sort(USE_PLATFORM);
+    sort.reserve(BIG_SIZE);
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> random(-1000, 1000);
+
+    for (size_t size: {size_t(BIG_SIZE), size_t(SMALL_SIZE), size_t(BIG_SIZE / 3)}) {
+        std::vector<int> data(size);
+        for (auto& x: data) x = random(gen);
+
+        std::vector<int> copy = data;
+        sort(data.begin(), data.end());
+        std::sort(copy.begin(), copy.end());
+
+        EXPECT_EQ(data, copy);
+    }
+
+    sort.setHighWaterMark(0);
+    sort.releaseBuffers();
+
+    std::vector<int> data(SMALL_SIZE);
+    for (auto& x: data) x = random(gen);
+    std::vector<int> copy = data;
+    sort(data.begin(), data.end(), OpenCLApp::DECREASING);
+    std::sort(copy.begin(), copy.end(), std::greater());
+
+    EXPECT_EQ(data, copy);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+TEST(BitonicSortTest, test_span) {
+    OpenCLApp::BitonicSorter<float> sort(USE_PLATFORM);
+
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<float> random{};
+
+    /* Power-of-two sizes may be sorted in place, the others go through the staging buffers */
+    for (size_t size: {size_t(1 << 16), size_t(SMALL_SIZE)}) {
+        std::vector<float> data(size);
+        for (auto& x: data) x = random(gen);
+
+        std::vector<float> copy = data;
+        sort(std::span<float>(data), OpenCLApp::DECREASING);
+        std::sort(copy.begin(), copy.end(), std::greater());
+
+        EXPECT_EQ(data, copy);
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+TEST(BitonicSortTest, test_sort_by_key) {
+    OpenCLApp::BitonicSorter<double> sort(USE_PLATFORM);
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> random(0, 100);
+
+    std::vector<double> keys(BIG_SIZE / 4 + 3);
+    std::vector<std::string> values(keys.size());
+    std::vector<std::pair<double, std::string>> copy;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        keys[i] = random(gen);
+        values[i] = std::to_string(keys[i]);
+        copy.emplace_back(keys[i], values[i]);
+    }
+
+    sort.sortByKey(keys.begin(), keys.end(), values.begin(), OpenCLApp::DECREASING);
+    std::sort(copy.begin(), copy.end(), std::greater());
+
+    for (size_t i = 0; i < keys.size(); ++i) {
+        EXPECT_EQ(keys[i], copy[i].first);
+        EXPECT_EQ(values[i], std::to_string(keys[i]));
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+TEST(BitonicSortTest, test_argsort) {
+    OpenCLApp::BitonicSorter<int> sort(USE_PLATFORM);
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> random(-1000, 1000);
+
+    std::vector<int> data(BIG_SIZE + 5);
+    for (auto& x: data) x = random(gen);
+
+    auto permutation = sort.argsort(data.begin(), data.end());
+
+    std::vector<uint32_t> sorted = permutation;
+    std::sort(sorted.begin(), sorted.end());
+    for (size_t i = 0; i < sorted.size(); ++i) EXPECT_EQ(sorted[i], i);
+
+    for (size_t i = 1; i < permutation.size(); ++i)
+        EXPECT_LE(data[permutation[i - 1]], data[permutation[i]]);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+TEST(BitonicSortTest, test_segments) {
+    OpenCLApp::BitonicSorter<unsigned> sort(USE_PLATFORM);
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<unsigned> random;
+    std::uniform_int_distribution<uint32_t> length(0, 1 << 16);
+
+    std::vector<uint32_t> offsets {0};
+    for (int i = 0; i < 100; ++i) offsets.push_back(offsets.back() + length(gen));
+
+    std::vector<unsigned> data(offsets.back());
+    for (auto& x: data) x = random(gen);
+
+    std::vector<unsigned> copy = data;
+    sort.sortSegments(data, offsets, OpenCLApp::DECREASING);
+    for (size_t i = 1; i < offsets.size(); ++i)
+        std::sort(copy.begin() + offsets[i - 1], copy.begin() + offsets[i], std::greater());
+
+    EXPECT_EQ(data, copy);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+TEST(BitonicSortTest, test_sort_async) {
+    OpenCLApp::BitonicSorter<int> sort(USE_PLATFORM);
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> random;
+
+    std::vector<std::vector<int>> batches(8, std::vector<int>(BIG_SIZE + 7));
+    std::vector<std::vector<int>> copies;
+    std::vector<std::future<void>> pending;
+    for (auto& batch: batches) {
+        for (auto& x: batch) x = random(gen);
+        copies.push_back(batch);
+        pending.push_back(sort.sortAsync(batch));
+    }
+
+    for (size_t i = 0; i < batches.size(); ++i) {
+        pending[i].get();
+        std::sort(copies[i].begin(), copies[i].end());
+        EXPECT_EQ(batches[i], copies[i]);
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+TEST(BitonicSortTest, test_program_cache) {
+    auto previous = OpenCLApp::ProgramCache::directory();
+    auto directory = std::filesystem::temp_directory_path() / "bsort-cache-test";
+    std::filesystem::remove_all(directory);
+    OpenCLApp::ProgramCache::setDirectory(directory);
+
+    std::vector<int> data {5, 3, 9, 1, 7, 2, 8};
+    std::vector<int> copy = data;
+    std::sort(copy.begin(), copy.end());
+
+    /* The first sorter builds from source and fills the cache, the second loads the binary */
+    { OpenCLApp::BitonicSorter<int> sort(USE_PLATFORM); }
+    EXPECT_FALSE(std::filesystem::is_empty(directory));
+
+    {
+        OpenCLApp::BitonicSorter<int> sort(USE_PLATFORM);
+        std::vector<int> result = data;
+        sort(result.begin(), result.end());
+        EXPECT_EQ(result, copy);
+    }
+
+    /* A corrupted entry falls back to a source build */
+    for (auto& entry: std::filesystem::directory_iterator(directory)) {
+        std::ofstream file {entry.path(), std::ios::binary | std::ios::app};
+        file << "garbage";
+    }
+    {
+        OpenCLApp::BitonicSorter<int> sort(USE_PLATFORM);
+        std::vector<int> result = data;
+        sort(result.begin(), result.end());
+        EXPECT_EQ(result, copy);
+    }
+
+    /* Entries are written through temporary files with unique names, none of which is left behind */
+    for (auto& entry: std::filesystem::directory_iterator(directory)) EXPECT_NE(entry.path().extension(), ".tmp");
+    auto first = OpenCLApp::ProgramCache::createTemp(directory / "entry.bin");
+    auto second = OpenCLApp::ProgramCache::createTemp(directory / "entry.bin");
+    EXPECT_NE(first, second);
+    EXPECT_TRUE(std::filesystem::exists(first));
+    EXPECT_TRUE(std::filesystem::exists(second));
+
+    std::filesystem::remove_all(directory);
+    OpenCLApp::ProgramCache::setDirectory(previous);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+TEST(BitonicSortTest, test_tuning_cache) {
+    auto previous = OpenCLApp::ProgramCache::directory();
+    auto directory = std::filesystem::temp_directory_path() / "bsort-tuning-test";
+    std::filesystem::remove_all(directory);
+    OpenCLApp::ProgramCache::setDirectory(directory);
+
+    /* An entry another process writes in between survives the next store */
+    OpenCLApp::TuningCache::store("first", 1);
+    { std::ofstream {directory / "tuning.txt", std::ios::app} << "other\t2\n"; }
+    OpenCLApp::TuningCache::store("second", 3);
+
+    std::ifstream file {directory / "tuning.txt"};
+    std::string table {std::istreambuf_iterator<char> {file}, std::istreambuf_iterator<char> {}};
+    EXPECT_EQ(table, "first\t1\nother\t2\nsecond\t3\n");
+    EXPECT_EQ(OpenCLApp::TuningCache::load("other"), 2u);
+    for (auto& entry: std::filesystem::directory_iterator(directory)) EXPECT_EQ(entry.path().filename(), "tuning.txt");
+
+    /* A lock file left behind by a crashed writer is removed once it is stale */
+    auto lock = directory / "tuning.txt.lock";
+    { std::ofstream {lock}; }
+    std::filesystem::last_write_time(lock, std::filesystem::file_time_type::clock::now() - std::chrono::minutes {1});
+    OpenCLApp::TuningCache::store("third", 4);
+    EXPECT_FALSE(std::filesystem::exists(lock));
+    EXPECT_EQ(OpenCLApp::TuningCache::load("third"), 4u);
+
+    /* Another cache directory has its own table */
+    auto other = std::filesystem::temp_directory_path() / "bsort-tuning-test-other";
+    std::filesystem::remove_all(other);
+    std::filesystem::create_directories(other);
+    { std::ofstream {other / "tuning.txt"} << "preset\t7\n"; }
+    OpenCLApp::ProgramCache::setDirectory(other);
+    EXPECT_EQ(OpenCLApp::TuningCache::load("preset"), 7u);
+    EXPECT_FALSE(OpenCLApp::TuningCache::load("first"));
+
+    std::filesystem::remove_all(directory);
+    std::filesystem::remove_all(other);
+    OpenCLApp::ProgramCache::setDirectory(previous);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+TEST(BitonicSortTest, test_sort_engine) {
+    auto& engine = OpenCLApp::SortEngine::instance(USE_PLATFORM);
+    EXPECT_EQ(&engine, &OpenCLApp::SortEngine::instance(USE_PLATFORM));
+
+    /* Sorters of different types share the engine, each keeps its own queues and buffers */
+    auto sortInt = engine.sorter<int>();
+    auto sortDouble = engine.sorter<double>();
+
+    std::vector<int> ints {4, -1, 3, 0, 2};
+    std::vector<double> doubles {0.5, -2.5, 1.5};
+    sortInt(ints.begin(), ints.end());
+    sortDouble(doubles.begin(), doubles.end(), OpenCLApp::DECREASING);
+
+    EXPECT_EQ(ints, (std::vector<int> {-1, 0, 2, 3, 4}));
+    EXPECT_EQ(doubles, (std::vector<double> {1.5, 0.5, -2.5}));
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+TEST(BitonicSortTest, test_host_threshold) {
+    /* Calibration is opt-in, a new sorter keeps everything on the device */
+    OpenCLApp::BitonicSorter<int> sort(USE_PLATFORM);
+    EXPECT_EQ(sort.hostThreshold(), 0u);
+    size_t crossover = sort.calibrate(true);
+    EXPECT_GT(crossover, 0u);
+    EXPECT_EQ(sort.hostThreshold(), crossover);
+
+    /* Later sorters take the stored crossover instead of measuring again */
+    OpenCLApp::BitonicSorter<int> other(USE_PLATFORM);
+    EXPECT_EQ(other.hostThreshold(), 0u);
+    EXPECT_EQ(other.calibrate(), crossover);
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> random;
+
+    /* Both sides of the crossover must agree */
+    for (size_t threshold: {size_t(0), size_t(BIG_SIZE) + 1}) {
+        sort.setHostThreshold(threshold);
+
+        std::vector<int> data(BIG_SIZE);
+        for (auto& x: data) x = random(gen);
+
+        std::vector<int> copy = data;
+        sort(data.begin(), data.end(), OpenCLApp::DECREASING);
+        std::sort(copy.begin(), copy.end(), std::greater());
+
+        EXPECT_EQ(data, copy);
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+TEST(BitonicSortTest, test_tuning_profile) {
+    OpenCLApp::BitonicSorter<double> sort(USE_PLATFORM);
+    sort.setHostThreshold(0);
+
+    /* Tuning is explicit, its profile is stored */
+    sort.tune();
+    size_t local = sort.maxLocalSize();
+    size_t steps = sort.fusedSteps();
+    EXPECT_TRUE(std::has_single_bit(local));
+    EXPECT_GE(steps, 1u);
+    EXPECT_LE(steps, OpenCLApp::BitonicSorter<double>::MAX_FUSED_STEPS);
+
+    /* Later sorters load it at construction */
+    OpenCLApp::BitonicSorter<double> other(USE_PLATFORM);
+    EXPECT_EQ(other.maxLocalSize(), local);
+    EXPECT_EQ(other.fusedSteps(), steps);
+
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<double> random{};
+
+    /* Any work-group size must produce the same result */
+    for (size_t limit: {size_t(1), size_t(2), size_t(64), local}) {
+        sort.setMaxLocalSize(limit);
+
+        std::vector<double> data(BIG_SIZE + 3);
+        for (auto& x: data) x = random(gen);
+
+        std::vector<double> copy = data;
+        sort(data.begin(), data.end());
+        std::sort(copy.begin(), copy.end());
+
+        EXPECT_EQ(data, copy);
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+TEST(BitonicSortTest, test_top_k) {
+    OpenCLApp::BitonicSorter<float> sort(USE_PLATFORM);
+    sort.setHostThreshold(0);
+
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<float> random(-1000, 1000);
+
+    std::vector<float> data(BIG_SIZE + 5);
+    for (auto& x: data) x = random(gen);
+    const std::vector<float> input = data;
+
+    for (size_t k: {size_t(1), size_t(5), size_t(100), size_t(4097)}) {
+        for (auto direction: {OpenCLApp::INCREASING, OpenCLApp::DECREASING}) {
+            std::vector<float> copy = input;
+            if (direction == OpenCLApp::INCREASING)
+                std::partial_sort(copy.begin(), copy.begin() + k, copy.end());
+            else
+                std::partial_sort(copy.begin(), copy.begin() + k, copy.end(), std::greater());
+            copy.resize(k);
+
+            auto top = sort.topK(data.begin(), data.end(), k, direction);
+            EXPECT_EQ(top, copy);
+        }
+    }
+
+    /* The input is left as it was, k is clamped to the size */
+    EXPECT_EQ(data, input);
+    EXPECT_EQ(sort.topK(data.begin(), data.begin() + 3, 10).size(), 3u);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+TEST(BitonicSortTest, test_merge) {
+    OpenCLApp::BitonicSorter<int> sort(USE_PLATFORM);
+    sort.setHostThreshold(0);
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> random(-1000, 1000);
+
+    std::vector<int> a(BIG_SIZE / 4 + 3), b(12345);
+    for (auto& x: a) x = random(gen);
+    for (auto& x: b) x = random(gen);
+
+    for (auto direction: {OpenCLApp::INCREASING, OpenCLApp::DECREASING}) {
+        if (direction == OpenCLApp::INCREASING) {
+            std::sort(a.begin(), a.end());
+            std::sort(b.begin(), b.end());
+        } else {
+            std::sort(a.begin(), a.end(), std::greater());
+            std::sort(b.begin(), b.end(), std::greater());
+        }
+
+        std::vector<int> merged(a.size() + b.size());
+        sort.merge(a, b, merged, direction);
+        std::vector<int> copy(merged.size());
+        if (direction == OpenCLApp::INCREASING) std::merge(a.begin(), a.end(), b.begin(), b.end(), copy.begin());
+        else std::merge(a.begin(), a.end(), b.begin(), b.end(), copy.begin(), std::greater());
+        EXPECT_EQ(merged, copy);
+
+        /* The batch is unsorted, only it gets sorted before the merge */
+        std::vector<int> sorted = a;
+        std::vector<int> batch(1001);
+        for (auto& x: batch) x = random(gen);
+        sort.insertSorted(sorted, batch, direction);
+
+        copy = a;
+        copy.insert(copy.end(), batch.begin(), batch.end());
+        if (direction == OpenCLApp::INCREASING) std::sort(copy.begin(), copy.end());
+        else std::sort(copy.begin(), copy.end(), std::greater());
+        EXPECT_EQ(sorted, copy);
+    }
+
+    std::vector<int> out(2);
+    EXPECT_THROW(sort.merge(a, b, out), std::runtime_error);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+TEST(BitonicSortTest, test_profiling) {
+    OpenCLApp::BitonicSorter<int> sort(USE_PLATFORM);
+    sort.setHostThreshold(0);
+    sort.setAlgorithm(OpenCLApp::BITONIC);
+    sort.setProfiling(true);
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> random;
+
+    std::vector<int> data(BIG_SIZE + 3);
+    for (auto& x: data) x = random(gen);
+
+    std::vector<int> copy = data;
+    sort(data.begin(), data.end());
+    std::sort(copy.begin(), copy.end());
+    EXPECT_EQ(data, copy);
+
+    /* Every launch and transfer is recorded, timestamps are ordered */
+    auto commands = sort.profile().commands();
+    ASSERT_FALSE(commands.empty());
+    for (auto& command: commands) {
+        EXPECT_LE(command.queued, command.submit);
+        EXPECT_LE(command.submit, command.start);
+        EXPECT_LE(command.start, command.end);
+    }
+
+    std::map<std::string, size_t> launches;
+    for (auto& stage: sort.profile().stats()) launches[stage.stage] += stage.launches;
+    EXPECT_EQ(launches["upload"], 1u);
+    EXPECT_EQ(launches["init"], 1u);
+    EXPECT_EQ(launches["download"], 1u);
+    EXPECT_EQ(launches["flip"], launches["merge_last"]);
+    EXPECT_GT(launches["flip"], 0u);
+
+    auto times = sort.lastSortTimes();
+    EXPECT_GT(times.upload.count(), 0);
+    EXPECT_GT(times.kernels.count(), 0);
+    EXPECT_GT(times.download.count(), 0);
+
+    std::ostringstream trace;
+    sort.profile().writeChromeTrace(trace);
+    EXPECT_NE(trace.str().find("\"traceEvents\""), std::string::npos);
+    EXPECT_NE(trace.str().find("\"merge_last\""), std::string::npos);
+
+    sort.clearProfile();
+    EXPECT_TRUE(sort.profile().empty());
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+TEST(BitonicSortTest, test_multi_device) {
+    OpenCLApp::SortEngine* engine = nullptr;
+    try {
+        engine = &OpenCLApp::SortEngine::instance(USE_PLATFORM, 2);
+    }
+    catch (std::exception&) {
+        GTEST_SKIP() << "Device can't be split into sub-devices";
+    }
+
+    EXPECT_EQ(engine->devices().size(), 2u);
+
+    auto sort = engine->sorter<int>();
+    sort.setHostThreshold(0);
+    sort.setProfiling(true);
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> random;
+
+    for (size_t size: {size_t(3), size_t(BIG_SIZE) + 5}) {
+        std::vector<int> data(size);
+        for (auto& x: data) x = random(gen);
+
+        std::vector<int> copy = data;
+        sort.clearProfile();
+        sort(data.begin(), data.end(), OpenCLApp::DECREASING);
+        std::sort(copy.begin(), copy.end(), std::greater());
+
+        EXPECT_EQ(data, copy);
+    }
+
+    /* Each device uploads, sorts and downloads its part once, the times are kept per device */
+    std::map<size_t, size_t> uploads, downloads;
+    for (auto& command: sort.profile().commands()) {
+        if (command.stage == "upload") ++uploads[command.device];
+        if (command.stage == "download") ++downloads[command.device];
+    }
+    for (size_t device = 0; device < sort.devices(); ++device) {
+        EXPECT_EQ(uploads[device], 1u);
+        EXPECT_EQ(downloads[device], 1u);
+        auto times = sort.lastSortTimes(device);
+        EXPECT_GT(times.upload.count(), 0);
+        EXPECT_GT(times.kernels.count(), 0);
+        EXPECT_GT(times.download.count(), 0);
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+template <size_t Width>
+void MaxSortSizeTestBody() {
+    /* The kernels index vector * width in uint over arrays padded up to twice their size */
+    using Sorter = OpenCLApp::BitonicSorter<int, Width>;
+    static_assert(std::has_single_bit(Sorter::MAX_INDEXED_SIZE));
+    static_assert(2 * Width * Sorter::MAX_INDEXED_SIZE <= size_t {std::numeric_limits<unsigned>::max()} + 1);
+
+    Sorter sort(USE_PLATFORM);
+    EXPECT_LE(sort.maxSortSize(), Sorter::MAX_INDEXED_SIZE);
+    EXPECT_GT(sort.maxSortSize(), 0u);
+}
+
+TEST(BitonicSortTest, test_max_sort_size) {
+    MaxSortSizeTestBody<4>();
+    MaxSortSizeTestBody<8>();
+    MaxSortSizeTestBody<16>();
+
+    /* Runs of the external sort are capped by it */
+    OpenCLApp::BitonicSorter<int> sort(USE_PLATFORM);
+    OpenCLApp::ExternalSorter<int> external(sort);
+    external.setRunSize(std::numeric_limits<size_t>::max());
+    EXPECT_EQ(external.runSize(), sort.maxSortSize());
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+TEST(BitonicSortTest, test_external_sort) {
+    OpenCLApp::BitonicSorter<int> sort(USE_PLATFORM);
+    OpenCLApp::ExternalSorter<int> external(sort);
+    external.setRunSize(BIG_SIZE / 8);
+    external.setBlockSize(1000);
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> random;
+
+    std::vector<int> data(BIG_SIZE + 3);
+    for (auto& x: data) x = random(gen);
+
+    auto input  = std::filesystem::temp_directory_path() / "bsort-external-input.bin";
+    auto output = std::filesystem::temp_directory_path() / "bsort-external-output.bin";
+    {
+        std::ofstream file {input, std::ios::binary};
+        file.write(reinterpret_cast<const char*>(data.data()), data.size() * sizeof(int));
+    }
+
+    external.sortFile(input, output, OpenCLApp::DECREASING);
+
+    std::vector<int> result(data.size());
+    {
+        std::ifstream file {output, std::ios::binary};
+        file.read(reinterpret_cast<char*>(result.data()), result.size() * sizeof(int));
+        EXPECT_EQ(file.gcount(), std::streamsize(result.size() * sizeof(int)));
+    }
+    std::sort(data.begin(), data.end(), std::greater());
+    EXPECT_EQ(result, data);
+
+    /* Spilled runs are removed once merged */
+    EXPECT_FALSE(std::filesystem::exists(output.string() + ".run0"));
+
+    std::filesystem::remove(input);
+    std::filesystem::remove(output);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+TEST(BitonicSortTest, test_fused_merge) {
+    OpenCLApp::BitonicSorter<float> sort(USE_PLATFORM);
+    sort.setHostThreshold(0);
+    sort.setAlgorithm(OpenCLApp::BITONIC);
+
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<float> random{};
+
+    /* Every fusion depth must produce the same network */
+    for (size_t steps = 1; steps <= OpenCLApp::BitonicSorter<float>::MAX_FUSED_STEPS; ++steps) {
+        sort.setFusedSteps(steps);
+
+        std::vector<float> keys(BIG_SIZE + 11);
+        for (auto& x: keys) x = random(gen);
+        std::vector<uint32_t> values(keys.size());
+        std::iota(values.begin(), values.end(), 0u);
+
+        std::vector<float> copy = keys;
+        std::vector<float> original = keys;
+        sort.sortByKey(keys.begin(), keys.end(), values.begin());
+        std::sort(copy.begin(), copy.end());
+
+        EXPECT_EQ(keys, copy);
+        for (size_t i = 0; i < keys.size(); ++i) EXPECT_EQ(original[values[i]], keys[i]);
+
+        sort(original.begin(), original.end());
+        EXPECT_EQ(original, copy);
+    }
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+template <size_t Width>
+void VectorWidthTestBody() {
+    static_assert(OpenCLApp::BitonicSorter<int, Width>::VECTOR_WIDTH == Width);
+
+    OpenCLApp::BitonicSorter<int, Width> sort(USE_PLATFORM);
+    sort.setHostThreshold(0);
+    sort.setAlgorithm(OpenCLApp::BITONIC);
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> random;
+
+    for (size_t size: {size_t(5), size_t(BIG_SIZE) + 7}) {
+        std::vector<int> data(size);
+        for (auto& x: data) x = random(gen);
+
+        std::vector<int> copy = data;
+        sort(data.begin(), data.end(), OpenCLApp::DECREASING);
+        std::sort(copy.begin(), copy.end(), std::greater());
+
+        EXPECT_EQ(data, copy);
+    }
+}
+
+TEST(BitonicSortTest, test_vector_width) {
+    static_assert(OpenCLApp::KernelTypeTraits<int8_t>::VECTOR_WIDTH == 16);
+    static_assert(OpenCLApp::KernelTypeTraits<int16_t>::VECTOR_WIDTH == 8);
+    static_assert(OpenCLApp::KernelTypeTraits<int>::VECTOR_WIDTH == 4);
+
+    VectorWidthTestBody<4>();
+    VectorWidthTestBody<8>();
+    VectorWidthTestBody<16>();
+
+    OpenCLApp::BitonicSorter<int> sort(USE_PLATFORM);
+    EXPECT_GT(sort.preferredVectorWidth(), 0u);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+template <typename T>
+void StableTestBody(size_t size) {
+    OpenCLApp::BitonicSorter<T> sort(USE_PLATFORM);
+    sort.setStable(true);
+    EXPECT_TRUE(sort.stable());
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> random(-8, 7);
+
+    /* Few distinct keys, so almost every key has ties */
+    std::vector<T> input(size);
+    for (auto& x: input) x = static_cast<T>(random(gen));
+
+    for (auto direction: {OpenCLApp::INCREASING, OpenCLApp::DECREASING}) {
+        std::vector<uint32_t> expected(input.size());
+        std::iota(expected.begin(), expected.end(), 0u);
+        std::stable_sort(expected.begin(), expected.end(), [&](uint32_t a, uint32_t b) {
+            return direction == OpenCLApp::INCREASING ? input[a] < input[b] : input[b] < input[a];
+        });
+        EXPECT_EQ(sort.argsort(input.begin(), input.end(), direction), expected);
+
+        /* Values that don't travel through the network are gathered in the same order */
+        std::vector<T> keys = input;
+        std::vector<std::string> names(input.size());
+        for (size_t i = 0; i < names.size(); ++i) names[i] = std::to_string(i);
+        sort.sortByKey(keys.begin(), keys.end(), names.begin(), direction);
+        for (size_t i = 0; i < names.size(); ++i) {
+            EXPECT_EQ(names[i], std::to_string(expected[i]));
+            if (names[i] != std::to_string(expected[i])) break;
+        }
+    }
+}
+
+TEST(BitonicSortTest, test_stable) {
+    /* Keys of every width, the tie-breaking network compares them with the index next to them */
+    StableTestBody<int>(BIG_SIZE + 9);
+    StableTestBody<double>((1 << 20) + 9);
+    StableTestBody<int64_t>((1 << 20) + 9);
+    StableTestBody<int16_t>((1 << 20) + 9);
+    StableTestBody<int8_t>((1 << 20) + 9);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+TEST(BitonicSortTest, test_stream_sort) {
+    OpenCLApp::BitonicSorter<int> sort(USE_PLATFORM);
+    OpenCLApp::StreamSorter<int> stream(sort);
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> random;
+
+    std::vector<int> data(100003);
+    for (auto& x: data) x = random(gen);
+
+    /* "N, then N numbers", with irregular whitespace */
+    std::string text = std::to_string(data.size()) + "\n";
+    for (size_t i = 0; i < data.size(); ++i) text += std::to_string(data[i]) + (i % 7 ? " " : "\r\n\t");
+
+    std::FILE* input = std::tmpfile();
+    std::FILE* output = std::tmpfile();
+    ASSERT_TRUE(input && output);
+    std::fwrite(text.data(), 1, text.size(), input);
+
+    /* Several runs force the merge */
+    for (size_t runSize: {size_t(1) << 24, size_t(4096)}) {
+        stream.setRunSize(runSize);
+        std::rewind(input);
+        std::rewind(output);
+        stream.sortCounted(input, output, OpenCLApp::DECREASING);
+
+        std::rewind(output);
+        OpenCLApp::TextReader reader {output};
+        std::vector<int> sorted(data.size() + 1);
+        sorted.resize(reader.read(sorted.data(), sorted.size()));
+
+        std::vector<int> copy = data;
+        std::sort(copy.begin(), copy.end(), std::greater());
+        EXPECT_EQ(sorted, copy);
+    }
+
+    std::fclose(input);
+    std::fclose(output);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+TEST(BitonicSortTest, test_concurrent) {
+    OpenCLApp::ConcurrentSorter<int> sort(USE_PLATFORM, 3, [](auto& sorter) { sorter.setHostThreshold(0); });
+    EXPECT_EQ(sort.sorters(), 1u);
+
+    /* More threads than sorters, so some of them wait for a lease */
+    std::vector<std::thread> threads;
+    std::vector<int> failures(8, 0);
+    for (size_t t = 0; t < failures.size(); ++t) {
+        threads.emplace_back([&, t] {
+            std::mt19937 gen(t);
+            std::uniform_int_distribution<int> random;
+            for (size_t i = 0; i < 5; ++i) {
+                std::vector<int> data(10000 + 1000 * t + i);
+                for (auto& x: data) x = random(gen);
+
+                std::vector<int> copy = data;
+                sort(data.begin(), data.end(), OpenCLApp::DECREASING);
+                std::sort(copy.begin(), copy.end(), std::greater());
+                failures[t] += data != copy;
+            }
+        });
+    }
+    for (auto& thread: threads) thread.join();
+
+    EXPECT_EQ(failures, std::vector<int>(failures.size(), 0));
+    EXPECT_LE(sort.sorters(), sort.maxSorters());
+    EXPECT_GE(sort.sorters(), 1u);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+TEST(BitonicSortTest, test_columns) {
+    OpenCLApp::ColumnSorter<uint32_t, int64_t, uint64_t> sort(USE_PLATFORM);
+
+    std::mt19937_64 gen(42);
+    std::uniform_int_distribution<uint32_t> tenants(0, 7);
+    std::uniform_int_distribution<int64_t> timestamps(-50, 50);
+
+    /* (tenant, timestamp, id), with many ties in the first two columns */
+    const size_t size = 100003;
+    std::vector<uint32_t> tenant(size);
+    std::vector<int64_t> timestamp(size);
+    std::vector<uint64_t> id(size);
+    for (size_t i = 0; i < size; ++i) {
+        tenant[i] = tenants(gen);
+        timestamp[i] = timestamps(gen);
+        id[i] = gen() % 1000;
+    }
+
+    std::vector<uint32_t> expected(size);
+    std::iota(expected.begin(), expected.end(), 0u);
+    std::stable_sort(expected.begin(), expected.end(), [&](uint32_t a, uint32_t b) {
+        return std::make_tuple(tenant[a], timestamp[b], id[a]) < std::make_tuple(tenant[b], timestamp[a], id[b]);
+    });
+
+    OpenCLApp::ColumnSorter<uint32_t, int64_t, uint64_t>::Directions directions {
+        OpenCLApp::INCREASING, OpenCLApp::DECREASING, OpenCLApp::INCREASING
+    };
+    EXPECT_EQ(sort.argsort(std::span<const uint32_t> {tenant}, std::span<const int64_t> {timestamp},
+                           std::span<const uint64_t> {id}, directions), expected);
+
+    /* Sorting in place applies the same order to every column */
+    auto rows = [&](size_t i) { return std::make_tuple(tenant[expected[i]], timestamp[expected[i]], id[expected[i]]); };
+    std::vector<std::tuple<uint32_t, int64_t, uint64_t>> sorted;
+    for (size_t i = 0; i < size; ++i) sorted.push_back(rows(i));
+
+    sort(std::span<uint32_t> {tenant}, std::span<int64_t> {timestamp}, std::span<uint64_t> {id}, directions);
+    for (size_t i = 0; i < size; ++i) {
+        EXPECT_EQ(std::make_tuple(tenant[i], timestamp[i], id[i]), sorted[i]);
+        if (std::make_tuple(tenant[i], timestamp[i], id[i]) != sorted[i]) break;
+    }
+    EXPECT_EQ(sort.passes(), 3u);
+
+    /* Columns of 56 bits in all make one key and one pass, NaNs go last and -0.0 ties with 0.0 as in the network */
+    OpenCLApp::ColumnSorter<int16_t, float, uint8_t> narrow(USE_PLATFORM);
+    EXPECT_EQ(narrow.passes(), 1u);
+
+    std::uniform_int_distribution<int> smalls(-3, 3);
+    std::vector<int16_t> group(size);
+    std::vector<float> score(size);
+    std::vector<uint8_t> flag(size);
+    for (size_t i = 0; i < size; ++i) {
+        group[i] = static_cast<int16_t>(smalls(gen));
+        int r = smalls(gen);
+        score[i] = r == 3 ? NAN : r == -3 ? -0.0f : static_cast<float>(r) / 2;
+        flag[i] = static_cast<uint8_t>(gen() % 3);
+    }
+
+    auto before = [](float a, float b) { return a < b || (std::isnan(b) && !std::isnan(a)); };
+    std::iota(expected.begin(), expected.end(), 0u);
+    std::stable_sort(expected.begin(), expected.end(), [&](uint32_t a, uint32_t b) {
+        if (group[a] != group[b]) return group[a] > group[b];
+        if (before(score[a], score[b]) || before(score[b], score[a])) return before(score[a], score[b]);
+        return flag[a] < flag[b];
+    });
+    EXPECT_EQ(narrow.argsort(std::span<const int16_t> {group}, std::span<const float> {score}, std::span<const uint8_t> {flag},
+                             {OpenCLApp::DECREASING, OpenCLApp::INCREASING, OpenCLApp::INCREASING}), expected);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+template <typename T>
+void RadixTestBody() {
+    static_assert(OpenCLApp::RadixSort<T>::SUPPORTED);
+
+    OpenCLApp::BitonicSorter<T> sort(USE_PLATFORM);
+    sort.setHostThreshold(0);
+    sort.setProfiling(true);
+
+    std::mt19937_64 gen(42);
+    std::uniform_int_distribution<int64_t> random(-1000000, 1000000);
+
+    for (size_t size: {size_t(1), size_t(1000), size_t(BIG_SIZE) + 13}) {
+        std::vector<T> input(size);
+        for (auto& x: input) x = static_cast<T>(random(gen)) / 7;
+
+        for (auto direction: {OpenCLApp::INCREASING, OpenCLApp::DECREASING}) {
+            std::vector<T> radix = input;
+            sort.setAlgorithm(OpenCLApp::RADIX);
+            sort(radix.begin(), radix.end(), direction);
+
+            std::vector<T> bitonic = input;
+            sort.setAlgorithm(OpenCLApp::BITONIC);
+            sort(bitonic.begin(), bitonic.end(), direction);
+
+            std::vector<T> expected = input;
+            if (direction == OpenCLApp::INCREASING) std::sort(expected.begin(), expected.end());
+            else std::sort(expected.begin(), expected.end(), std::greater());
+
+            EXPECT_EQ(radix, expected);
+            EXPECT_EQ(bitonic, expected);
+        }
+    }
+
+    std::map<std::string, size_t> launches;
+    for (auto& stage: sort.profile().stats()) launches[stage.stage] += stage.launches;
+    EXPECT_GT(launches["radix_scatter"], 0u);
+    EXPECT_EQ(launches["radix_histogram"], launches["radix_scatter"]);
+}
+
+TEST(BitonicSortTest, test_radix) {
+    RadixTestBody<int>();
+    RadixTestBody<float>();
+    RadixTestBody<double>();
+    RadixTestBody<int64_t>();
+
+    static_assert(!OpenCLApp::RadixSort<int16_t>::SUPPORTED);
+    OpenCLApp::BitonicSorter<int16_t> sort(USE_PLATFORM);
+    EXPECT_EQ(sort.algorithm(), OpenCLApp::AUTOMATIC);
+}
+
+//------------------------------------------------------------------------------------------------------------------------------
+
+TEST(BitonicSortTest, test_comparator) {
+    std::mt19937 gen(25);
+    std::uniform_real_distribution<float> dist(-100, 100);
+    auto magnitudes = [](std::vector<float> data) {
+        for (auto& x: data) x = std::fabs(x);
+        return data;
+    };
+
+    /* Decreasing by absolute value, ties between x and -x may come in either order */
+    OpenCLApp::BitonicSorter<float> byMagnitude(USE_PLATFORM, "#define KEY(x) fabs(x)\n#define ORDER_MAX NAN\n#define ORDER_MIN 0.0f");
+    byMagnitude.setHostThreshold(1 << 20);
+    EXPECT_EQ(byMagnitude.hostThreshold(), 0u);
+    EXPECT_THROW(OpenCLApp::ExternalSorter<float> {byMagnitude}, std::runtime_error);
+
+    for (size_t size: {SMALL_SIZE, 1000, (1 << 16) + 3}) {
+        std::vector<float> data(size);
+        for (auto& x: data) x = dist(gen);
+
+        std::vector<float> expected = data;
+        std::sort(expected.begin(), expected.end(), [](float a, float b) { return std::fabs(a) > std::fabs(b); });
+        std::vector<float> sorted = data;
+        byMagnitude(sorted.begin(), sorted.end(), OpenCLApp::DECREASING);
+        EXPECT_EQ(magnitudes(sorted), magnitudes(expected));
+
+        std::sort(sorted.begin(), sorted.end());
+        std::sort(data.begin(), data.end());
+        EXPECT_EQ(sorted, data);
+    }
+
+    /* The natural order puts NaNs after every number, on the host, in the network and in the radix sort */
+    auto same = [](const std::vector<float>& lhs, const std::vector<float>& rhs) {
+        return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), [](float a, float b) {
+            return a == b || (std::isnan(a) && std::isnan(b));
+        });
+    };
+
+    OpenCLApp::BitonicSorter<float> sort(USE_PLATFORM);
+    for (auto algorithm: {OpenCLApp::BITONIC, OpenCLApp::RADIX}) {
+        for (size_t threshold: {size_t(1) << 30, size_t(0)}) {
+            sort.setAlgorithm(algorithm);
+            sort.setHostThreshold(threshold);
+            for (auto direction: {OpenCLApp::INCREASING, OpenCLApp::DECREASING}) {
+                std::vector<float> data(1000);
+                for (auto& x: data) x = gen() % 10 ? dist(gen) : std::numeric_limits<float>::quiet_NaN();
+
+                std::vector<float> expected = data;
+                if (direction == OpenCLApp::INCREASING) std::sort(expected.begin(), expected.end(), OpenCLApp::SortLess<float> {});
+                else std::sort(expected.begin(), expected.end(), OpenCLApp::SortGreater<float> {});
+                EXPECT_TRUE(std::isnan(direction == OpenCLApp::INCREASING ? expected.back() : expected.front()));
+
+                sort(data.begin(), data.end(), direction);
+                EXPECT_TRUE(same(data, expected));
+            }
+        }
+    }
+}
 
 //------------------------------------------------------------------------------------------------------------------------------
 